@@ -1,291 +1,587 @@
-#ifdef __SSE4_1__
-#include <nmmintrin.h>
-#endif
-
-#include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <list>
-#include <set>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 
-// return the value at bit position idx
-template <typename NumberType>
-inline NumberType Get(NumberType value, NumberType idx) {
-  assert(idx < sizeof(NumberType) * 8);
-  return (value >> idx) & NumberType(0x01);
-}
+#include "devils_checkerboard.h"
 
-template <typename NumberType>
-struct Setter {
-  NumberType* target;
-  NumberType index;
-
-  void operator=(NumberType value) {
-    // clear the bit position
-    *target &= ~(NumberType(0x01) << index);
-    // set the bit position
-    *target |= (value & NumberType(0x01)) << index;
+static const char kUsage[] =
+    "\
+usage: devils_checkerboard [options]\n\
+  --ndim=LIST        dimensions to run, e.g. 2,4,16 or 2-8 (default 2,4,16)\n\
+  --source=SOURCE    mirror, greedy, oracle (greedy without storing it),\n\
+                     file:PATH, anneal or search (default mirror)\n\
+  --threads=N        worker threads, 1 to 1024 (default: hardware\n\
+                     concurrency)\n\
+  --simd=BACKEND     auto, scalar, avx2 or avx512, used for greedy colorings\n\
+                     (default auto)\n\
+  --format=FORMAT    text or json (default text)\n\
+  --timing           report the time spent building and validating\n\
+  --all-violations   report every violating state, not just the first\n\
+  --sweep=N          validate N random cycle assignments per dimension\n\
+                     instead of a single source\n\
+  --seed=N           seed for --sweep and --screen (default 0)\n\
+  --screen=N         check N random states before the full pass\n\
+                     (default 256 with --sweep, otherwise off)\n\
+  --stratified       spread the --screen samples over the popcount layers\n\
+  --checkpoint=PATH  save progress of validation and search to PATH.<ndim>\n\
+                     every --checkpoint-interval states or search nodes,\n\
+                     and resume from there (default 2^30)\n\
+  --pipeline=PATH    with --source=greedy, generate, validate and write the\n\
+                     coloring as text to PATH.<ndim> in overlapped stages\n\
+  --stats            print the kernel counters as JSON at exit\n\
+\n\
+--all-violations, --screen and --checkpoint select different validation\n\
+passes, so at most one of them can be given, except that --checkpoint with\n\
+--source=search also checkpoints the search.\n\
+";
+
+struct DriverOptions {
+  DriverOptions()
+      : source("mirror"),
+        num_threads(std::thread::hardware_concurrency()),
+        backend(GetBestSimdBackend()),
+        format("text"),
+        timing(false),
+        all_violations(false),
+        n_sweep(0),
+        seed(0),
+        checkpoint_interval(UINT64_C(1) << 30),
+        stats(false) {
+    if (num_threads < 1) {
+      num_threads = 1;
+    }
+    screening.num_samples = 0;
   }
+
+  std::vector<uint64_t> ndims;
+  std::string source;
+  // coloring file for source file:PATH
+  std::string path;
+  unsigned num_threads;
+  SimdBackend backend;
+  std::string format;
+  bool timing;
+  bool all_violations;
+  // number of random CycleParams per dimension, 0 to run the source
+  uint64_t n_sweep;
+  uint64_t seed;
+  // samples checked before the full pass, num_samples 0 if off
+  ScreeningOptions screening;
+  // empty for no checkpoints
+  std::string checkpoint_path;
+  uint64_t checkpoint_interval;
+  // empty to validate in memory instead
+  std::string pipeline_path;
+  bool stats;
 };
 
-// set the value at bit position idx
-template <typename NumberType>
-inline Setter<NumberType> Set(NumberType* value, NumberType idx) {
-  assert(idx < sizeof(NumberType) * 8);
-  return Setter<NumberType>{value, idx};
+// results of one run, printed by PrintRun
+struct DriverRun {
+  DriverRun()
+      : ndim(0),
+        is_found(true),
+        is_valid(false),
+        n_violations(0),
+        is_screened(false),
+        is_written(true),
+        build_seconds(0),
+        validate_seconds(0) {}
+
+  uint64_t ndim;
+  // false if the source produced no coloring, e.g. search exhausted
+  bool is_found;
+  bool is_valid;
+  // only counted with --all-violations
+  uint64_t n_violations;
+  // only set with --screen
+  bool is_screened;
+  ScreeningResult screening;
+  // false if some --all-violations diagnostics could not be written
+  bool is_written;
+  double build_seconds;
+  double validate_seconds;
+};
+
+static bool ParseDimensions(const std::string& value,
+                            std::vector<uint64_t>* ndims) {
+  std::stringstream list(value);
+  std::string item;
+  while (std::getline(list, item, ',')) {
+    char* end = nullptr;
+    uint64_t first = std::strtoull(item.c_str(), &end, 10);
+    uint64_t last = first;
+    if (*end == '-') {
+      last = std::strtoull(end + 1, &end, 10);
+    }
+    if (end == item.c_str() || *end != '\0' || first < 1 || last < first ||
+        last > 63) {
+      return false;
+    }
+    for (uint64_t ndim = first; ndim <= last; ++ndim) {
+      ndims->push_back(ndim);
+    }
+  }
+  return !ndims->empty();
 }
 
-// set the value from a string
-template <typename NumberType>
-inline void ParseString(const std::string& value_str, NumberType* value) {
-  assert(value_str.size() <= sizeof(NumberType) * 8);
-  for (NumberType i = 0; i < value_str.size(); ++i) {
-    assert(value_str[i] == '0' || value_str[i] == '1');
-    Set(value, i) = value_str[i] - '0';
+// more threads than this is a typo rather than a machine
+static const long kMaxThreads = 1024;
+
+static bool ParseThreads(const std::string& value, unsigned* num_threads) {
+  char* end = nullptr;
+  long n = std::strtol(value.c_str(), &end, 10);
+  if (end == value.c_str() || *end != '\0' || n < 1 || n > kMaxThreads) {
+    return false;
   }
+  *num_threads = static_cast<unsigned>(n);
+  return true;
 }
 
-template <typename NumberType>
-std::string ToString(NumberType value, NumberType ndim) {
-  assert(ndim <= sizeof(NumberType) * 8);
-  std::string result;
-  result.resize(ndim + 1);
-  result[0] = 'b';
-  for (NumberType i = 0; i < ndim; ++i) {
-    result[i + 1] = '0' + Get(value, i);
+static bool ParseBackend(const std::string& value, SimdBackend* backend) {
+  SimdBackend best = GetBestSimdBackend();
+  if (value == "auto") {
+    *backend = best;
+    return true;
+  }
+  for (SimdBackend candidate :
+       {SimdBackend::kScalar, SimdBackend::kAVX2, SimdBackend::kAVX512}) {
+    if (value == GetSimdBackendName(candidate)) {
+      if (static_cast<int>(candidate) > static_cast<int>(best)) {
+        fmt::print(std::cerr, "SIMD backend {} is not available, best is {}\n",
+                   value, GetSimdBackendName(best));
+        return false;
+      }
+      *backend = candidate;
+      return true;
+    }
   }
+  return false;
+}
 
-  return result;
+// return false and print the usage on bad arguments
+static bool ParseOptions(int argc, char** argv, DriverOptions* options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    size_t equals = arg.find('=');
+    if (equals != std::string::npos) {
+      value = arg.substr(equals + 1);
+      arg = arg.substr(0, equals);
+    }
+
+    bool is_ok = true;
+    if (arg == "--ndim") {
+      is_ok = ParseDimensions(value, &options->ndims);
+    } else if (arg == "--source") {
+      if (value.compare(0, 5, "file:") == 0) {
+        options->source = "file";
+        options->path = value.substr(5);
+        is_ok = !options->path.empty();
+      } else {
+        options->source = value;
+        is_ok = value == "mirror" || value == "greedy" || value == "oracle" ||
+                value == "anneal" || value == "search";
+      }
+    } else if (arg == "--threads") {
+      is_ok = ParseThreads(value, &options->num_threads);
+    } else if (arg == "--simd") {
+      is_ok = ParseBackend(value, &options->backend);
+    } else if (arg == "--format") {
+      options->format = value;
+      is_ok = value == "text" || value == "json";
+    } else if (arg == "--timing") {
+      options->timing = true;
+    } else if (arg == "--all-violations") {
+      options->all_violations = true;
+    } else if (arg == "--stats") {
+      options->stats = true;
+    } else if (arg == "--sweep") {
+      options->n_sweep = std::strtoull(value.c_str(), nullptr, 10);
+      is_ok = options->n_sweep > 0;
+    } else if (arg == "--seed") {
+      options->seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (arg == "--screen") {
+      options->screening.num_samples = std::atoi(value.c_str());
+      is_ok = options->screening.num_samples > 0;
+    } else if (arg == "--checkpoint") {
+      options->checkpoint_path = value;
+      is_ok = !value.empty();
+    } else if (arg == "--checkpoint-interval") {
+      options->checkpoint_interval = std::strtoull(value.c_str(), nullptr, 10);
+      is_ok = options->checkpoint_interval > 0;
+    } else if (arg == "--pipeline") {
+      options->pipeline_path = value;
+      is_ok = !value.empty();
+    } else if (arg == "--stratified") {
+      options->screening.is_stratified = true;
+    } else if (arg == "--help") {
+      is_ok = false;
+    } else {
+      fmt::print(std::cerr, "Unknown option {}\n", arg);
+      is_ok = false;
+    }
+
+    if (!is_ok) {
+      std::cerr << kUsage;
+      return false;
+    }
+  }
+
+  if (!options->pipeline_path.empty() && options->source != "greedy") {
+    fmt::print(std::cerr, "--pipeline needs --source=greedy\n");
+    std::cerr << kUsage;
+    return false;
+  }
+
+  // --all-violations, --screen and --checkpoint each pick a different full
+  // pass, and --sweep and --pipeline run their own. With --source=search the
+  // checkpoint also covers the search, which combines with any of them.
+  bool is_screened = options->screening.num_samples > 0;
+  bool is_checkpointed =
+      !options->checkpoint_path.empty() && options->source != "search";
+  const char* conflict = nullptr;
+  if (options->all_violations && is_screened) {
+    conflict = "--all-violations and --screen";
+  } else if (options->all_violations && is_checkpointed) {
+    conflict = "--all-violations and --checkpoint";
+  } else if (is_screened && is_checkpointed) {
+    conflict = "--screen and --checkpoint";
+  } else if (options->n_sweep > 0 &&
+             (options->all_violations || is_checkpointed)) {
+    conflict = "--sweep and --all-violations or --checkpoint";
+  } else if (!options->pipeline_path.empty() &&
+             (options->all_violations || is_screened || is_checkpointed)) {
+    conflict = "--pipeline and --all-violations, --screen or --checkpoint";
+  }
+  if (conflict) {
+    fmt::print(std::cerr, "{} cannot be combined\n", conflict);
+    std::cerr << kUsage;
+    return false;
+  }
+
+  options->screening.seed = options->seed;
+  if (options->n_sweep > 0 && options->screening.num_samples == 0) {
+    options->screening.num_samples = 256;
+  }
+  if (options->ndims.empty()) {
+    options->ndims = {2, 4, 16};
+  }
+  return true;
 }
 
-// There are 2^n states
-template <typename NumberType>
-inline NumberType GetNumberOfStates(NumberType ndim) {
-  return NumberType(0x01) << ndim;
+static std::string GetCheckpointPath(const DriverOptions& options,
+                                     uint64_t ndim) {
+  return fmt::format("{}.{}", options.checkpoint_path, ndim);
 }
 
-// round number of colors up to next even integer
-template <typename NumberType>
-inline NumberType GetNumberOfColors(NumberType ndim) {
-  // return 2 * ((ndim + 1) / 2);
-  return ndim;
+static double GetSecondsSince(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
 }
 
-#ifdef __SSE4_1__
-inline uint32_t PopCount(uint32_t value) {
-  return _mm_popcnt_u32(value);
+// GenerateColoring with the fixed-dimension kernels when single threaded
+template <typename NumberType>
+static std::vector<NumberType> Generate(NumberType ndim,
+                                        const DriverOptions& options) {
+  if (options.num_threads > 1) {
+    return ParallelGenerateColoring(ndim, options.num_threads);
+  }
+  return DispatchGenerateColoring(ndim);
 }
 
-inline uint64_t PopCount(uint64_t value) {
-  return _mm_popcnt_u64(value);
+// Validate with the fixed-dimension kernels when single threaded, otherwise
+// split the states over the worker threads
+template <class ColorAssignment>
+static bool Validate(const ColorAssignment& coloring, uint64_t ndim,
+                     const DriverOptions& options) {
+  if (options.num_threads > 1) {
+    return ParallelValidateColoring(coloring, ndim, options.num_threads);
+  }
+  return DispatchValidateColoring(coloring, ndim);
 }
-#else
-// http://stackoverflow.com/questions/109023/how-to-count-the-number-of-set-bits-in-a-32-bit-integer
-inline uint32_t PopCount(uint32_t value) {
-  // C or C++: use uint32_t
-  value = value - ((value >> 1) & 0x55555555);
-  value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
-  return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+
+// 32-bit colorings go through the SIMD kernels, on every worker thread
+static bool Validate(const std::vector<uint32_t>& coloring, uint64_t ndim,
+                     const DriverOptions& options) {
+  if (options.num_threads > 1) {
+    return ParallelValidateColoring(coloring, static_cast<uint32_t>(ndim),
+                                    options.num_threads, options.backend);
+  }
+  return ValidateColoring(coloring, static_cast<uint32_t>(ndim),
+                          options.backend);
 }
 
-// http://www.drdobbs.com/parallel/integer-64-bit-optimizations/184405995
-inline uint64_t PopCount(uint64_t value) {
-  value = (value & 0x5555555555555555LU) + (value >> 1 & 0x5555555555555555LU);
-  value = (value & 0x3333333333333333LU) + (value >> 2 & 0x3333333333333333LU);
-  value = value + (value >> 4) & 0x0F0F0F0F0F0F0F0FLU;
-  value = value + (value >> 8);
-  value = value + (value >> 16);
-  value = value + (value >> 32) & 0x0000007F;
-  return value;
+// report every violating state to fd, return how many there are
+template <class ColorAssignment>
+static uint64_t CollectAll(const ColorAssignment& coloring, uint64_t ndim,
+                           const DriverOptions& options, int fd,
+                           bool* is_written) {
+  return CollectViolations(coloring, ndim, options.num_threads, fd,
+                           is_written);
 }
-#endif
 
-template <typename NumberType>
-struct MirrorAssignment {
-  MirrorAssignment(NumberType ndim) : ndim_(ndim) {}
+static uint64_t CollectAll(const std::vector<uint32_t>& coloring,
+                           uint64_t ndim, const DriverOptions& options, int fd,
+                           bool* is_written) {
+  return CollectViolations(coloring, static_cast<uint32_t>(ndim),
+                           options.num_threads, fd, is_written);
+}
 
-  NumberType operator[](NumberType state) const {
-    assert(state < (NumberType(0x01) << ndim_));
+// print the header and picture of a coloring before it is validated
+template <class ColorAssignment>
+static void PrintColoringHeader(const ColorAssignment& coloring, uint64_t ndim,
+                                const DriverOptions& options) {
+  if (options.format != "text") {
+    return;
+  }
+  fmt::print(std::cout, "\n\nn = {}, {} states, {} colors\n", ndim,
+             GetNumberOfStates<uint64_t>(ndim),
+             GetNumberOfColors<uint64_t>(ndim));
+  PrintColoring(std::cout, coloring, ndim);
+}
 
-    NumberType cycle_offset = state % (ndim_ * 2);
-    if (cycle_offset < ndim_) {
-      return cycle_offset;
-    } else {
-      return 2 * ndim_ - cycle_offset - 1;
+template <class ColorAssignment>
+static void RunValidation(const ColorAssignment& coloring,
+                          const DriverOptions& options, DriverRun* run) {
+  PrintColoringHeader(coloring, run->ndim, options);
+  auto start = std::chrono::steady_clock::now();
+  if (options.all_violations) {
+    // diagnostics are written straight to the file descriptor behind
+    // std::cout, which is stderr in json mode
+    std::cout.flush();
+    int fd = options.format == "json" ? STDERR_FILENO : STDOUT_FILENO;
+    run->n_violations =
+        CollectAll(coloring, run->ndim, options, fd, &run->is_written);
+    run->is_valid = run->n_violations == 0;
+    if (!run->is_written) {
+      fmt::print(std::cerr, "Failed to write the violations of n = {}\n",
+                 run->ndim);
     }
+  } else if (options.screening.num_samples > 0) {
+    run->is_screened = true;
+    run->is_valid = ValidateColoring(coloring, run->ndim, options.screening,
+                                     &run->screening);
+  } else if (!options.checkpoint_path.empty()) {
+    run->is_valid = ValidateColoringCheckpointed(
+        coloring, run->ndim, GetCheckpointPath(options, run->ndim),
+        options.checkpoint_interval);
+  } else {
+    run->is_valid = Validate(coloring, run->ndim, options);
   }
+  run->validate_seconds = GetSecondsSince(start);
+}
 
-  NumberType ndim_;
-};
-
-template <typename NumberType, class ColorAssignment>
-bool ValidateColoring(const ColorAssignment& coloring, NumberType ndim) {
-  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
-  NumberType n_colors = ndim;
-
-  for (NumberType current_state = 0; current_state < n_states;
-       ++current_state) {
-    // bit-vector of colors seen among neighbors (including self)
-    NumberType colors_seen = 0;
-    Set(&colors_seen, coloring[current_state]) = 1;
-
-    for (NumberType i = 0; i < ndim; ++i) {
-      NumberType neighbor_state = current_state;
-      if (Get(current_state, i)) {
-        Set(&neighbor_state, i) = 0;
-      } else {
-        Set(&neighbor_state, i) = 1;
-      }
-
-      Set(&colors_seen, coloring[neighbor_state]) = 1;
+static void PrintRun(std::ostream& out, const DriverRun& run,
+                     const DriverOptions& options) {
+  if (options.format == "json") {
+    fmt::print(out,
+               "{{\"ndim\": {}, \"source\": \"{}\", \"states\": {}, "
+               "\"colors\": {}, \"found\": {}, \"valid\": {}",
+               run.ndim, options.source, GetNumberOfStates<uint64_t>(run.ndim),
+               GetNumberOfColors<uint64_t>(run.ndim),
+               run.is_found ? "true" : "false",
+               run.is_valid ? "true" : "false");
+    if (options.all_violations) {
+      fmt::print(out, ", \"violations\": {}", run.n_violations);
     }
-
-    if (PopCount(colors_seen) != n_colors) {
-      fmt::print(
-          std::cout,
-          "For state {1:0{0}b}, saw {2} ({3:0{0}b}) colors, expected {4:d}\n",
-          ndim, current_state, PopCount(colors_seen), colors_seen, n_colors);
-            fmt::print(std::cout, "colors_seen: {:08b}\n", colors_seen);
-      return false;
+    if (run.is_screened) {
+      fmt::print(out,
+                 ", \"rejected_by_sample\": {}, \"skipped_fraction\": {:.6f}",
+                 run.screening.is_rejected_by_sample ? "true" : "false",
+                 run.screening.skipped_fraction);
+    }
+    if (options.timing) {
+      fmt::print(out,
+                 ", \"build_seconds\": {:.6f}, \"validate_seconds\": {:.6f}",
+                 run.build_seconds, run.validate_seconds);
+    }
+    fmt::print(out, "}}\n");
+  } else {
+    if (!run.is_found) {
+      fmt::print(out, "\n\nn = {}, no coloring found by {}\n", run.ndim,
+                 options.source);
+      return;
+    }
+    if (options.all_violations) {
+      fmt::print(out, "Violations: {}\n", run.n_violations);
+    }
+    if (run.is_screened) {
+      fmt::print(out, "Screening: {}, skipped {:.2f}% of the full pass\n",
+                 run.screening.is_rejected_by_sample ? "rejected by sample"
+                                                     : "passed",
+                 100 * run.screening.skipped_fraction);
+    }
+    fmt::print(out, "Validated: {}\n", (run.is_valid ? "yes" : "no"));
+    if (options.timing) {
+      fmt::print(out, "Build: {:.6f} s, validate: {:.6f} s\n",
+                 run.build_seconds, run.validate_seconds);
     }
   }
-
-  return true;
+  out.flush();
 }
 
-static const std::string kFormat2 =
-    "\
-  (10) o ----- o (11)   (00) : {0:d} \n\
-       |       |        (01) : {1:d} \n\
-       |       |        (10) : {2:d} \n\
-  (00) o-------o (01)   (11) : {3:d} \n\
-";
+// return false if the diagnostics of the run could not be written
+static bool RunDimension(std::ostream& out, uint64_t ndim,
+                         const DriverOptions& options) {
+  DriverRun run;
+  run.ndim = ndim;
+  auto start = std::chrono::steady_clock::now();
+
+  if (options.source == "mirror") {
+    MirrorTableAssignment<uint64_t> coloring(ndim);
+    run.build_seconds = GetSecondsSince(start);
+    RunValidation(coloring, options, &run);
+  } else if (options.source == "oracle") {
+    GreedyColorOracle<uint64_t> coloring(ndim);
+    run.build_seconds = GetSecondsSince(start);
+    RunValidation(coloring, options, &run);
+  } else if (options.source == "greedy" && !options.pipeline_path.empty()) {
+    // nothing is materialized, so build and validate time overlap
+    std::ofstream file(fmt::format("{}.{}", options.pipeline_path, ndim));
+    ColoringTextSink sink(file);
+    PrintColoringHeader(GreedyColorOracle<uint64_t>(ndim), ndim, options);
+    run.is_valid = PipelineColoring(ndim, sink);
+    sink.Flush();
+    run.build_seconds = GetSecondsSince(start);
+    if (!file) {
+      fmt::print(std::cerr, "Failed to write {}.{}\n", options.pipeline_path,
+                 ndim);
+      run.is_written = false;
+    }
+  } else if (options.source == "greedy") {
+    // 32-bit colorings go through the SIMD kernels
+    if (ndim < 32) {
+      std::vector<uint32_t> coloring =
+          Generate(static_cast<uint32_t>(ndim), options);
+      run.build_seconds = GetSecondsSince(start);
+      RunValidation(coloring, options, &run);
+    } else {
+      std::vector<uint64_t> coloring = Generate(ndim, options);
+      run.build_seconds = GetSecondsSince(start);
+      RunValidation(coloring, options, &run);
+    }
+  } else if (options.source == "anneal" || options.source == "search") {
+    ColoringSolution<uint64_t> solution;
+    if (options.source == "anneal") {
+      AnnealingOptions annealing;
+      annealing.num_threads = options.num_threads;
+      solution = AnnealColoring(ndim, annealing);
+    } else if (!options.checkpoint_path.empty()) {
+      run.is_found = SearchColoringCheckpointed(
+          ndim, &solution, GetCheckpointPath(options, ndim),
+          options.checkpoint_interval);
+    } else {
+      run.is_found = ParallelSearchColoring(ndim, options.num_threads,
+                                            &solution);
+    }
+    run.build_seconds = GetSecondsSince(start);
+    if (run.is_found) {
+      RunValidation(solution, options, &run);
+    }
+  }
 
-static const std::string kFormat3 =
-    "\
-\n\
-    (110) o-------o (111)   (000) : {0:d} \n\
-         /|      /|         (001) : {1:d} \n\
- (010)  / |     / |         (010) : {2:d} \n\
-       o ----- o  o (101)   (011) : {3:d} \n\
-       | /     | /          (100) : {4:d} \n\
-       |/      |/           (101) : {5:d} \n\
- (000) o-------o (001)      (110) : {6:d} \n\
-                            (111) : {7:d} \n\
-";
+  PrintRun(out, run, options);
+  return run.is_written;
+}
 
-template <typename NumberType, class ColorAssignment>
-void PrintColoring(std::ostream& out, const ColorAssignment& coloring,
-                   NumberType ndim) {
-  switch (ndim) {
-    case 2: {
-      fmt::print(out, kFormat2, coloring[0], coloring[1], coloring[2],
-                 coloring[3]);
-      break;
-    }
+// validate random members of the CycleAssignment family
+static void RunSweep(std::ostream& out, uint64_t ndim,
+                     const DriverOptions& options) {
+  std::mt19937_64 generator(options.seed + ndim);
+  std::vector<CycleParams> candidates;
+  candidates.reserve(options.n_sweep);
+  for (uint64_t i = 0; i < options.n_sweep; ++i) {
+    candidates.push_back(GetRandomCycleParams(ndim, generator));
+  }
 
-    case 3: {
-      fmt::print(out, kFormat3, coloring[0], coloring[1], coloring[2],
-                 coloring[3], coloring[4], coloring[5], coloring[6],
-                 coloring[7]);
-      break;
+  ScreeningOptions screening = options.screening;
+  screening.seed = generator();
+  auto start = std::chrono::steady_clock::now();
+  CycleSweepResult result =
+      SweepCycleAssignments(candidates, ndim, screening);
+  double seconds = GetSecondsSince(start);
+
+  if (options.format == "json") {
+    fmt::print(out,
+               "{{\"ndim\": {}, \"source\": \"sweep\", \"candidates\": {}, "
+               "\"valid\": {}, \"rejected_by_sample\": {}, "
+               "\"rejected_by_full_pass\": {}, \"states_checked\": {}",
+               ndim, candidates.size(), result.valid.size(),
+               result.n_rejected_by_sample, result.n_rejected_by_full_pass,
+               result.n_checked);
+    if (options.timing) {
+      fmt::print(out, ", \"validate_seconds\": {:.6f}", seconds);
     }
-
-    case 4: {
-      break;
+    fmt::print(out, "}}\n");
+  } else {
+    fmt::print(out, "\n\nn = {}, {} cycle assignments\n", ndim,
+               candidates.size());
+    fmt::print(out, "Valid: {}, rejected by sample: {}, by full pass: {}\n",
+               result.valid.size(), result.n_rejected_by_sample,
+               result.n_rejected_by_full_pass);
+    fmt::print(out, "States checked: {}\n", result.n_checked);
+    if (options.timing) {
+      fmt::print(out, "Validate: {:.6f} s\n", seconds);
     }
-
-    default:
-      out << "No visualization for dimension " << ndim << "\n";
   }
+  out.flush();
 }
 
-int main(int argc, char** argv) {
-  for (uint64_t ndim = 2; ndim < 17; ndim *= ndim) {
-    MirrorAssignment<uint64_t> coloring(ndim);
-    fmt::print(std::cout, "\n\nn = {}, {} states, {} colors\n", ndim,
-               GetNumberOfStates<uint64_t>(ndim),
-               GetNumberOfColors<uint64_t>(ndim));
-
-    PrintColoring(std::cout, coloring, ndim);
-    bool is_valid = ValidateColoring(coloring, ndim);
-    fmt::print(std::cout, "Validated: {}\n", (is_valid ? "yes" : "no"));
-    std::cout.flush();
+// the dimension of a coloring file comes from its header. Return false if
+// the file cannot be opened or the diagnostics could not be written.
+static bool RunFile(std::ostream& out, const DriverOptions& options) {
+  DriverRun run;
+  auto start = std::chrono::steady_clock::now();
+  MappedColoring<uint64_t> coloring;
+  if (!coloring.Open(options.path)) {
+    return false;
   }
-  return 0;
+  run.ndim = coloring.ndim_;
+  run.build_seconds = GetSecondsSince(start);
+  RunValidation(coloring, options, &run);
+  PrintRun(out, run, options);
+  return run.is_written;
 }
 
-template <typename NumberType>
-struct TopologicalCompare {
-  bool operator()(NumberType a, NumberType b) {
-    // Same depth, return sorted order
-    if (PopCount(a) == PopCount(b)) {
-      return a > b;
-      // Different depth, handle lower depth first
-    } else {
-      return PopCount(a) < PopCount(b);
-    }
+int main(int argc, char** argv) {
+  DriverOptions options;
+  if (!ParseOptions(argc, argv, &options)) {
+    return 2;
   }
-};
 
-// Cycle over colors in topological order
-template <typename NumberType>
-std::vector<NumberType> GenerateColoring(NumberType ndim) {
-  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
-  NumberType num_colors = GetNumberOfColors<NumberType>(ndim);
-  NumberType next_color = 0;
-
-  std::set<NumberType, TopologicalCompare<NumberType>> queue;
-
-  std::vector<NumberType> result(n_states);
-  std::vector<bool> open(n_states, false);
-  std::vector<bool> closed(n_states, false);
-
-  open[0] = true;
-  queue.insert(0);
-
-  while (queue.size() > 0) {
-    auto front_iter = queue.begin();
-    NumberType current_state = *front_iter;
-    queue.erase(front_iter);
-    assert(current_state < result.size());
-
-    if (!closed[current_state]) {
-      closed[current_state] = true;
-      result[current_state] = next_color;
-      next_color = (next_color + 1) % num_colors;
-    }
+  // keep the violation diagnostics out of the JSON records
+  std::streambuf* cout_buffer = std::cout.rdbuf();
+  std::ostream records(cout_buffer);
+  if (options.format == "json") {
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
 
-    for (NumberType i = 0; i < ndim; ++i) {
-      NumberType child_state = current_state;
-      if (Get(child_state, i) == 0) {
-        Set(&child_state, i) = 1;
-        if (!open[child_state]) {
-          open[child_state] = true;
-          queue.insert(child_state);
-        }
+  int status = 0;
+  if (options.source == "file") {
+    status = RunFile(records, options) ? 0 : 1;
+  } else {
+    for (uint64_t ndim : options.ndims) {
+      if (options.n_sweep > 0) {
+        RunSweep(records, ndim, options);
+      } else if (!RunDimension(records, ndim, options)) {
+        status = 1;
       }
     }
   }
 
-  return result;
-}
-
-int old_main(int argc, char** argv) {
-  for (uint32_t ndim = 2; ndim < 5; ++ndim) {
-    fmt::print(std::cout, "\n\nn = {}, {} states, {} colors\n", ndim,
-               GetNumberOfStates<uint32_t>(ndim),
-               GetNumberOfColors<uint32_t>(ndim));
-
-    std::vector<uint32_t> coloring = GenerateColoring<uint32_t>(ndim);
-    PrintColoring(std::cout, coloring, ndim);
-    bool is_valid = ValidateColoring(coloring, ndim);
-    fmt::print(std::cout, "Validated: {}\n", (is_valid ? "yes" : "no"));
-    std::cout.flush();
+  std::cout.rdbuf(cout_buffer);
+  if (options.stats) {
+    PrintStats(std::cout);
   }
-  return 0;
-}
\ No newline at end of file
+  return status;
+}
@@ -0,0 +1,3915 @@
+#ifndef DEVILS_CHECKERBOARD_H_
+#define DEVILS_CHECKERBOARD_H_
+
+#ifdef __SSE4_1__
+#include <nmmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DEVILS_CHECKERBOARD_X86_SIMD 1
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+// return the value at bit position idx
+template <typename NumberType>
+inline NumberType Get(NumberType value, NumberType idx) {
+  assert(idx < sizeof(NumberType) * 8);
+  return (value >> idx) & NumberType(0x01);
+}
+
+template <typename NumberType>
+struct Setter {
+  NumberType* target;
+  NumberType index;
+
+  void operator=(NumberType value) {
+    // clear the bit position
+    *target &= ~(NumberType(0x01) << index);
+    // set the bit position
+    *target |= (value & NumberType(0x01)) << index;
+  }
+};
+
+// set the value at bit position idx
+template <typename NumberType>
+inline Setter<NumberType> Set(NumberType* value, NumberType idx) {
+  assert(idx < sizeof(NumberType) * 8);
+  return Setter<NumberType>{value, idx};
+}
+
+// set the value from a string
+template <typename NumberType>
+inline void ParseString(const std::string& value_str, NumberType* value) {
+  assert(value_str.size() <= sizeof(NumberType) * 8);
+  for (NumberType i = 0; i < value_str.size(); ++i) {
+    assert(value_str[i] == '0' || value_str[i] == '1');
+    Set(value, i) = value_str[i] - '0';
+  }
+}
+
+template <typename NumberType>
+std::string ToString(NumberType value, NumberType ndim) {
+  assert(ndim <= sizeof(NumberType) * 8);
+  std::string result;
+  result.resize(ndim + 1);
+  result[0] = 'b';
+  for (NumberType i = 0; i < ndim; ++i) {
+    result[i + 1] = '0' + Get(value, i);
+  }
+
+  return result;
+}
+
+// binary digits of the low ndim bits of value, most significant first, the
+// way FormatViolation prints states. Works for wide state types.
+template <typename NumberType>
+std::string ToBinaryString(NumberType value, unsigned ndim) {
+  assert(ndim <= sizeof(NumberType) * 8);
+  std::string result(ndim, '0');
+  for (unsigned i = 0; i < ndim; ++i) {
+    result[ndim - 1 - i] = '0' + Get(value, NumberType(i));
+  }
+
+  return result;
+}
+
+// There are 2^n states
+template <typename NumberType>
+inline NumberType GetNumberOfStates(NumberType ndim) {
+  return NumberType(0x01) << ndim;
+}
+
+// round number of colors up to next even integer
+template <typename NumberType>
+inline NumberType GetNumberOfColors(NumberType ndim) {
+  // return 2 * ((ndim + 1) / 2);
+  return ndim;
+}
+
+#ifdef __SSE4_1__
+inline uint32_t PopCount(uint32_t value) {
+  return _mm_popcnt_u32(value);
+}
+
+inline uint64_t PopCount(uint64_t value) {
+  return _mm_popcnt_u64(value);
+}
+#else
+// http://stackoverflow.com/questions/109023/how-to-count-the-number-of-set-bits-in-a-32-bit-integer
+inline uint32_t PopCount(uint32_t value) {
+  // C or C++: use uint32_t
+  value = value - ((value >> 1) & 0x55555555);
+  value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+  return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// http://www.drdobbs.com/parallel/integer-64-bit-optimizations/184405995
+inline uint64_t PopCount(uint64_t value) {
+  value = (value & 0x5555555555555555LU) + (value >> 1 & 0x5555555555555555LU);
+  value = (value & 0x3333333333333333LU) + (value >> 2 & 0x3333333333333333LU);
+  value = value + (value >> 4) & 0x0F0F0F0F0F0F0F0FLU;
+  value = value + (value >> 8);
+  value = value + (value >> 16);
+  value = value + (value >> 32) & 0x0000007F;
+  return value;
+}
+#endif
+
+// return the index of the lowest set bit, value must be nonzero
+inline uint32_t CountTrailingZeros(uint32_t value) {
+  assert(value != 0);
+  return __builtin_ctz(value);
+}
+
+inline uint64_t CountTrailingZeros(uint64_t value) {
+  assert(value != 0);
+  return __builtin_ctzll(value);
+}
+
+// Counters for the validators and generators, compiled in with
+// -DDEVILS_CHECKERBOARD_STATS. Every thread counts into its own ThreadStats,
+// which is registered once under a lock, so the hot path is a plain add.
+// Kernels add their totals once per call or range, not once per state.
+enum StatsPhase { kPhaseGenerate, kPhaseValidate, kNumStatsPhases };
+
+struct ThreadStats {
+  ThreadStats()
+      : states_visited(0),
+        neighbor_lookups(0),
+        states_emitted(0),
+        peak_frontier_states(0),
+        bytes_allocated(0) {
+    std::fill(phase_seconds, phase_seconds + kNumStatsPhases, 0.0);
+  }
+
+  uint64_t states_visited;
+  uint64_t neighbor_lookups;
+  uint64_t states_emitted;
+  uint64_t peak_frontier_states;
+  uint64_t bytes_allocated;
+  double phase_seconds[kNumStatsPhases];
+};
+
+struct StatsRegistry {
+  static StatsRegistry& Get() {
+    static StatsRegistry registry;
+    return registry;
+  }
+
+  // std::list keeps the slots in place while other threads register
+  ThreadStats* Register() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.emplace_back();
+    return &threads_.back();
+  }
+
+  // sum over all threads that ever counted, peaks are the maximum
+  ThreadStats Aggregate(unsigned* n_threads) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ThreadStats total;
+    for (const ThreadStats& stats : threads_) {
+      total.states_visited += stats.states_visited;
+      total.neighbor_lookups += stats.neighbor_lookups;
+      total.states_emitted += stats.states_emitted;
+      total.peak_frontier_states =
+          std::max(total.peak_frontier_states, stats.peak_frontier_states);
+      total.bytes_allocated += stats.bytes_allocated;
+      for (int i = 0; i < kNumStatsPhases; ++i) {
+        total.phase_seconds[i] += stats.phase_seconds[i];
+      }
+    }
+    *n_threads = static_cast<unsigned>(threads_.size());
+    return total;
+  }
+
+  std::mutex mutex_;
+  std::list<ThreadStats> threads_;
+};
+
+inline ThreadStats& GetThreadStats() {
+  static thread_local ThreadStats* stats = StatsRegistry::Get().Register();
+  return *stats;
+}
+
+// adds the wall time of its scope to a phase of the calling thread
+struct ScopedPhaseTimer {
+  explicit ScopedPhaseTimer(StatsPhase phase)
+      : phase_(phase), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedPhaseTimer() {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    GetThreadStats().phase_seconds[phase_] += elapsed.count();
+  }
+
+  StatsPhase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#ifdef DEVILS_CHECKERBOARD_STATS
+#define DEVILS_CHECKERBOARD_COUNT(counter, n) (GetThreadStats().counter += (n))
+#define DEVILS_CHECKERBOARD_PEAK(counter, n)                       \
+  (GetThreadStats().counter = std::max<uint64_t>(GetThreadStats().counter, \
+                                                 (n)))
+#define DEVILS_CHECKERBOARD_PHASE(phase) ScopedPhaseTimer phase_timer(phase)
+#else
+// sizeof keeps the arguments used without evaluating them, so values that
+// are only computed for the counters do not trigger -Wunused-variable
+#define DEVILS_CHECKERBOARD_COUNT(counter, n) ((void)sizeof(n))
+#define DEVILS_CHECKERBOARD_PEAK(counter, n) ((void)sizeof(n))
+#define DEVILS_CHECKERBOARD_PHASE(phase) ((void)0)
+#endif
+
+// print the aggregated counters as a JSON object
+inline void PrintStats(std::ostream& out) {
+  unsigned n_threads = 0;
+  ThreadStats total = StatsRegistry::Get().Aggregate(&n_threads);
+#ifdef DEVILS_CHECKERBOARD_STATS
+  bool is_enabled = true;
+#else
+  bool is_enabled = false;
+#endif
+  fmt::print(out, "{{\n");
+  fmt::print(out, "  \"enabled\": {},\n", is_enabled ? "true" : "false");
+  fmt::print(out, "  \"threads\": {},\n", n_threads);
+  fmt::print(out, "  \"states_visited\": {},\n", total.states_visited);
+  fmt::print(out, "  \"neighbor_lookups\": {},\n", total.neighbor_lookups);
+  fmt::print(out, "  \"states_emitted\": {},\n", total.states_emitted);
+  fmt::print(out, "  \"peak_frontier_states\": {},\n",
+             total.peak_frontier_states);
+  fmt::print(out, "  \"bytes_allocated\": {},\n", total.bytes_allocated);
+  fmt::print(out, "  \"phase_seconds\": {{\"generate\": {:.6f}, "
+                  "\"validate\": {:.6f}}}\n",
+             total.phase_seconds[kPhaseGenerate],
+             total.phase_seconds[kPhaseValidate]);
+  fmt::print(out, "}}\n");
+}
+
+template <typename NumberType>
+struct MirrorAssignment {
+  MirrorAssignment(NumberType ndim) : ndim_(ndim) {}
+
+  NumberType operator[](NumberType state) const {
+    assert(state < (NumberType(0x01) << ndim_));
+
+    NumberType cycle_offset = state % (ndim_ * 2);
+    if (cycle_offset < ndim_) {
+      return cycle_offset;
+    } else {
+      return 2 * ndim_ - cycle_offset - 1;
+    }
+  }
+
+  NumberType ndim_;
+};
+
+// return value % divisor for 32-bit operands using a precomputed
+// multiplier = UINT64_MAX / divisor + 1, without an integer division
+// (Lemire, "Faster Remainder by Direct Computation")
+inline uint32_t FastMod(uint32_t value, uint64_t multiplier, uint32_t divisor) {
+  uint64_t lowbits = multiplier * value;
+  return static_cast<uint32_t>(
+      (static_cast<unsigned __int128>(lowbits) * divisor) >> 64);
+}
+
+// return value % divisor for a 64-bit value, where high_word_offset is
+// 2^32 % divisor and divisor is at most 2^16 so that folding the high word
+// into the low one does not overflow
+inline uint32_t FastMod64(uint64_t value, uint64_t multiplier, uint32_t divisor,
+                          uint32_t high_word_offset) {
+  uint32_t high_word = static_cast<uint32_t>(value >> 32);
+  uint32_t offset =
+      FastMod(static_cast<uint32_t>(value), multiplier, divisor);
+  if (high_word) {
+    offset = FastMod(
+        FastMod(high_word, multiplier, divisor) * high_word_offset + offset,
+        multiplier, divisor);
+  }
+  return offset;
+}
+
+// Same coloring as MirrorAssignment, but the zig-zag cycle is precomputed into
+// a lookup table and the offset into the cycle is computed with FastMod, so
+// lookups need neither a division nor a branch on the cycle half.
+template <typename NumberType>
+struct MirrorTableAssignment {
+  MirrorTableAssignment(NumberType ndim)
+      : ndim_(ndim),
+        cycle_length_(static_cast<uint32_t>(2 * ndim)),
+        multiplier_(UINT64_C(0xFFFFFFFFFFFFFFFF) / cycle_length_ + 1) {
+    assert(ndim > 0 && ndim <= sizeof(NumberType) * 8);
+    assert(cycle_length_ <= sizeof(table_));
+    for (uint32_t i = 0; i < cycle_length_; ++i) {
+      table_[i] = i < ndim ? i : cycle_length_ - i - 1;
+    }
+    // 2^32 % cycle_length, used to fold the high word of large states
+    high_word_offset_ = static_cast<uint32_t>((UINT64_C(1) << 32) %
+                                              cycle_length_);
+  }
+
+  NumberType operator[](NumberType state) const {
+    assert(state < (NumberType(0x01) << ndim_));
+    return table_[GetCycleOffset(state)];
+  }
+
+  // return state % (2 * ndim)
+  uint32_t GetCycleOffset(NumberType state) const {
+    return FastMod64(state, multiplier_, cycle_length_, high_word_offset_);
+  }
+
+  NumberType ndim_;
+  uint32_t cycle_length_;
+  uint64_t multiplier_;
+  uint32_t high_word_offset_;
+  uint8_t table_[128];
+};
+
+// return the number of bits needed to store colors in [0, n_colors)
+inline unsigned GetBitsPerColor(uint64_t n_colors) {
+  unsigned bits = 1;
+  while (bits < 64 && (UINT64_C(0x01) << bits) < n_colors) {
+    ++bits;
+  }
+  return bits;
+}
+
+// return the number of 64-bit words needed to pack n_states colors
+inline uint64_t GetNumberOfPackedWords(uint64_t n_states,
+                                       unsigned bits_per_color) {
+  return (n_states * bits_per_color + 63) / 64;
+}
+
+// Read-only view of a coloring packed bits_per_color bits per state into
+// 64-bit words. A color may straddle two words.
+template <typename NumberType>
+struct PackedColorView {
+  PackedColorView(const uint64_t* words, unsigned bits_per_color)
+      : words_(words),
+        bits_per_color_(bits_per_color),
+        mask_((UINT64_C(0x01) << bits_per_color) - 1) {
+    assert(bits_per_color > 0 && bits_per_color < 64);
+  }
+
+  NumberType operator[](NumberType state) const {
+    uint64_t bit = static_cast<uint64_t>(state) * bits_per_color_;
+    uint64_t word = bit / 64;
+    unsigned offset = bit % 64;
+    uint64_t value = words_[word] >> offset;
+    if (offset + bits_per_color_ > 64) {
+      value |= words_[word + 1] << (64 - offset);
+    }
+    return static_cast<NumberType>(value & mask_);
+  }
+
+  const uint64_t* words_;
+  unsigned bits_per_color_;
+  uint64_t mask_;
+};
+
+// Coloring which stores ceil(log2(n_colors)) bits per state instead of a full
+// NumberType. Reset() reuses the existing storage, so one PackedColoring can
+// serve as the result buffer for many generated colorings.
+template <typename NumberType>
+struct PackedColoring {
+  PackedColoring() : n_states_(0), bits_per_color_(1) {}
+
+  PackedColoring(NumberType n_states, unsigned bits_per_color) {
+    Reset(n_states, bits_per_color);
+  }
+
+  // resize for n_states colors of bits_per_color bits, all set to zero
+  void Reset(NumberType n_states, unsigned bits_per_color) {
+    assert(bits_per_color > 0 && bits_per_color < 64);
+    n_states_ = n_states;
+    bits_per_color_ = bits_per_color;
+    words_.assign(GetNumberOfPackedWords(n_states, bits_per_color), 0);
+    DEVILS_CHECKERBOARD_COUNT(bytes_allocated,
+                              words_.size() * sizeof(uint64_t));
+  }
+
+  void SetColor(NumberType state, NumberType color) {
+    assert(state < n_states_);
+    uint64_t mask = (UINT64_C(0x01) << bits_per_color_) - 1;
+    assert(color <= mask);
+    uint64_t bit = static_cast<uint64_t>(state) * bits_per_color_;
+    uint64_t word = bit / 64;
+    unsigned offset = bit % 64;
+    words_[word] = (words_[word] & ~(mask << offset)) |
+                   (static_cast<uint64_t>(color) << offset);
+    if (offset + bits_per_color_ > 64) {
+      unsigned shift = 64 - offset;
+      words_[word + 1] = (words_[word + 1] & ~(mask >> shift)) |
+                         (static_cast<uint64_t>(color) >> shift);
+    }
+  }
+
+  NumberType operator[](NumberType state) const {
+    assert(state < n_states_);
+    return GetView()[state];
+  }
+
+  PackedColorView<NumberType> GetView() const {
+    return PackedColorView<NumberType>(words_.data(), bits_per_color_);
+  }
+
+  NumberType size() const {
+    return n_states_;
+  }
+
+  NumberType n_states_;
+  unsigned bits_per_color_;
+  std::vector<uint64_t> words_;
+};
+
+// return the bit-vector of colors seen in the closed neighborhood of state
+template <typename NumberType, class ColorAssignment>
+inline NumberType GetColorsSeen(const ColorAssignment& coloring,
+                                NumberType ndim, NumberType current_state) {
+  // bit-vector of colors seen among neighbors (including self)
+  NumberType colors_seen = 0;
+  Set(&colors_seen, NumberType(coloring[current_state])) = 1;
+
+  for (NumberType i = 0; i < ndim; ++i) {
+    NumberType neighbor_state = current_state;
+    if (Get(current_state, i)) {
+      Set(&neighbor_state, i) = 0;
+    } else {
+      Set(&neighbor_state, i) = 1;
+    }
+
+    Set(&colors_seen, NumberType(coloring[neighbor_state])) = 1;
+  }
+
+  return colors_seen;
+}
+
+// append the diagnostic for a state whose closed neighborhood is missing
+// colors to out
+template <typename NumberType>
+void FormatViolation(fmt::MemoryWriter* out, NumberType ndim,
+                     NumberType current_state, NumberType colors_seen) {
+  NumberType n_colors = ndim;
+  out->write(
+      "For state {1:0{0}b}, saw {2} ({3:0{0}b}) colors, expected {4:d}\n",
+      ndim, current_state, PopCount(colors_seen), colors_seen, n_colors);
+  out->write("colors_seen: {:08b}\n", colors_seen);
+}
+
+// print a diagnostic for a state whose closed neighborhood is missing colors
+template <typename NumberType>
+void ReportViolation(NumberType ndim, NumberType current_state,
+                     NumberType colors_seen) {
+  fmt::MemoryWriter out;
+  FormatViolation(&out, ndim, current_state, colors_seen);
+  std::cout.write(out.data(), out.size());
+}
+
+template <typename NumberType, class ColorAssignment>
+bool ValidateColoring(const ColorAssignment& coloring, NumberType ndim) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = ndim;
+
+  for (NumberType current_state = 0; current_state < n_states;
+       ++current_state) {
+    NumberType colors_seen = GetColorsSeen(coloring, ndim, current_state);
+    if (PopCount(colors_seen) != n_colors) {
+      DEVILS_CHECKERBOARD_COUNT(states_visited, current_state + 1);
+      DEVILS_CHECKERBOARD_COUNT(neighbor_lookups,
+                                (current_state + 1) * (ndim + 1));
+      ReportViolation(ndim, current_state, colors_seen);
+      return false;
+    }
+  }
+
+  DEVILS_CHECKERBOARD_COUNT(states_visited, n_states);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, n_states * (ndim + 1));
+  return true;
+}
+
+// Same as ValidateColoring but the state space is split into num_threads
+// contiguous ranges which are checked concurrently. Workers stop as soon as
+// they pass the lowest failing state found so far, so the state reported is
+// the same one the serial version would report.
+template <typename NumberType, class ColorAssignment>
+bool ParallelValidateColoring(const ColorAssignment& coloring, NumberType ndim,
+                              unsigned num_threads) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = ndim;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (n_states < num_threads) {
+    num_threads = static_cast<unsigned>(n_states);
+  }
+
+  // lowest failing state found by any worker, n_states if none
+  std::atomic<NumberType> first_failure(n_states);
+
+  auto worker = [&](NumberType begin, NumberType end) {
+    NumberType current_state = begin;
+    for (; current_state < end; ++current_state) {
+      // some other worker already found an earlier failure
+      if (current_state > first_failure.load(std::memory_order_relaxed)) {
+        break;
+      }
+
+      NumberType colors_seen = GetColorsSeen(coloring, ndim, current_state);
+      if (PopCount(colors_seen) != n_colors) {
+        NumberType prev = first_failure.load();
+        while (current_state < prev &&
+               !first_failure.compare_exchange_weak(prev, current_state)) {
+        }
+        break;
+      }
+    }
+    DEVILS_CHECKERBOARD_COUNT(states_visited, current_state - begin);
+    DEVILS_CHECKERBOARD_COUNT(neighbor_lookups,
+                              (current_state - begin) * (ndim + 1));
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  NumberType states_per_thread = n_states / num_threads;
+  NumberType remainder = n_states % num_threads;
+  NumberType begin = 0;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    NumberType end = begin + states_per_thread + (i < remainder ? 1 : 0);
+    threads.emplace_back(worker, begin, end);
+    begin = end;
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  NumberType failed_state = first_failure.load();
+  if (failed_state < n_states) {
+    ReportViolation(ndim, failed_state,
+                    GetColorsSeen(coloring, ndim, failed_state));
+    return false;
+  }
+
+  return true;
+}
+
+// Fixed-capacity bit-vector of colors for colorings with more colors than
+// there are bits in NumberType. Cache-line aligned so that one set of up to
+// 512 colors never straddles two lines.
+template <unsigned NWORDS>
+struct alignas(64) ColorSet {
+  ColorSet() {
+    for (unsigned i = 0; i < NWORDS; ++i) {
+      words_[i] = 0;
+    }
+  }
+
+  static constexpr unsigned kCapacity = NWORDS * 64;
+
+  void Insert(uint64_t color) {
+    assert(color < kCapacity);
+    words_[color / 64] |= UINT64_C(0x01) << (color % 64);
+  }
+
+  bool Contains(uint64_t color) const {
+    assert(color < kCapacity);
+    return (words_[color / 64] >> (color % 64)) & 0x01;
+  }
+
+  uint64_t words_[NWORDS];
+};
+
+template <unsigned NWORDS>
+inline uint64_t PopCount(const ColorSet<NWORDS>& colors) {
+  uint64_t count = 0;
+  for (unsigned i = 0; i < NWORDS; ++i) {
+    count += PopCount(colors.words_[i]);
+  }
+  return count;
+}
+
+// return the set of colors seen in the closed neighborhood of state. Works for
+// wide state types such as unsigned __int128.
+template <unsigned NWORDS, typename NumberType, class ColorAssignment>
+inline ColorSet<NWORDS> GetColorSet(const ColorAssignment& coloring,
+                                    unsigned ndim, NumberType current_state) {
+  ColorSet<NWORDS> colors_seen;
+  colors_seen.Insert(coloring[current_state]);
+  for (unsigned i = 0; i < ndim; ++i) {
+    colors_seen.Insert(coloring[current_state ^ (NumberType(0x01) << i)]);
+  }
+  return colors_seen;
+}
+
+// Validate the states in [begin, end) of a coloring with up to NWORDS * 64
+// colors. For large dimensions the full cube cannot be enumerated, so the
+// caller picks the range to check.
+template <unsigned NWORDS, typename NumberType, class ColorAssignment>
+bool ValidateStateRange(const ColorAssignment& coloring, unsigned ndim,
+                        NumberType begin, NumberType end) {
+  uint64_t n_colors = GetNumberOfColors<uint64_t>(ndim);
+  assert(n_colors <= ColorSet<NWORDS>::kCapacity);
+  assert(ndim <= sizeof(NumberType) * 8);
+
+  for (NumberType current_state = begin; current_state < end;
+       ++current_state) {
+    ColorSet<NWORDS> colors_seen =
+        GetColorSet<NWORDS>(coloring, ndim, current_state);
+    if (PopCount(colors_seen) != n_colors) {
+      fmt::print(std::cout, "For state {}, saw {} colors, expected {:d}\n",
+                 ToBinaryString(current_state, ndim),
+                 PopCount(colors_seen), n_colors);
+      std::string missing;
+      for (uint64_t color = 0; color < n_colors; ++color) {
+        if (!colors_seen.Contains(color)) {
+          missing += fmt::format(" {}", color);
+        }
+      }
+      fmt::print(std::cout, "missing colors:{}\n", missing);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Dimensions for which the kernels below are specialized at compile time
+static const unsigned kMinFixedDimension = 2;
+static const unsigned kMaxFixedDimension = 32;
+
+// return the largest specialized dimension whose states fit in NumberType
+template <typename NumberType>
+constexpr unsigned GetMaxFixedDimension() {
+  return sizeof(NumberType) * 8 - 1 < kMaxFixedDimension
+             ? sizeof(NumberType) * 8 - 1
+             : kMaxFixedDimension;
+}
+
+// narrowest word that can hold a one-hot mask of NDIM colors
+template <unsigned NDIM>
+struct ColorMask {
+  typedef typename std::conditional<(NDIM <= 32), uint32_t, uint64_t>::type
+      Type;
+};
+
+// OR together the one-hot colors of state and its neighbors across the
+// first I dimensions. The recursion fully unrolls the neighbor loop.
+template <unsigned I, typename MaskType>
+struct ColorsSeenUnroll {
+  template <typename NumberType, class ColorAssignment>
+  static MaskType Get(const ColorAssignment& coloring, NumberType state) {
+    return ColorsSeenUnroll<I - 1, MaskType>::Get(coloring, state) |
+           (MaskType(0x01) << coloring[state ^ (NumberType(0x01) << (I - 1))]);
+  }
+};
+
+template <typename MaskType>
+struct ColorsSeenUnroll<0, MaskType> {
+  template <typename NumberType, class ColorAssignment>
+  static MaskType Get(const ColorAssignment& coloring, NumberType state) {
+    return MaskType(0x01) << coloring[state];
+  }
+};
+
+// return the first state in [begin, end) whose closed neighborhood does not
+// see all NDIM colors, or end if there is none
+template <unsigned NDIM, typename NumberType, class ColorAssignment>
+NumberType FindFirstViolationFixed(const ColorAssignment& coloring,
+                                   NumberType begin, NumberType end) {
+  typedef typename ColorMask<NDIM>::Type MaskType;
+  static_assert(NDIM < sizeof(NumberType) * 8,
+                "states of this dimension do not fit in NumberType");
+
+  for (NumberType current_state = begin; current_state < end;
+       ++current_state) {
+    MaskType colors_seen =
+        ColorsSeenUnroll<NDIM, MaskType>::Get(coloring, current_state);
+    if (PopCount(colors_seen) != NDIM) {
+      return current_state;
+    }
+  }
+  return end;
+}
+
+// Same as ValidateColoring with the dimension fixed at compile time
+template <unsigned NDIM, typename NumberType, class ColorAssignment>
+bool ValidateColoringFixed(const ColorAssignment& coloring) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  NumberType ndim = NDIM;
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType failed_state =
+      FindFirstViolationFixed<NDIM>(coloring, NumberType(0), n_states);
+  NumberType n_visited = std::min<NumberType>(failed_state + 1, n_states);
+  DEVILS_CHECKERBOARD_COUNT(states_visited, n_visited);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, n_visited * (NDIM + 1));
+  if (failed_state < n_states) {
+    ReportViolation(ndim, failed_state,
+                    GetColorsSeen(coloring, ndim, failed_state));
+    return false;
+  }
+  return true;
+}
+
+// Calls Kernel::Run<NDIM>(args...) for the NDIM equal to the runtime ndim, or
+// Kernel::RunDynamic(ndim, args...) if ndim is outside [NDIM, MAXDIM]
+template <class Kernel, unsigned NDIM, unsigned MAXDIM,
+          bool kPastEnd = (NDIM > MAXDIM)>
+struct DimensionDispatch {
+  template <typename... Args>
+  static typename Kernel::ResultType Run(unsigned ndim, Args&&... args) {
+    if (ndim == NDIM) {
+      return Kernel::template Run<NDIM>(std::forward<Args>(args)...);
+    }
+    return DimensionDispatch<Kernel, NDIM + 1, MAXDIM>::Run(
+        ndim, std::forward<Args>(args)...);
+  }
+};
+
+template <class Kernel, unsigned NDIM, unsigned MAXDIM>
+struct DimensionDispatch<Kernel, NDIM, MAXDIM, true> {
+  template <typename... Args>
+  static typename Kernel::ResultType Run(unsigned ndim, Args&&... args) {
+    return Kernel::RunDynamic(ndim, std::forward<Args>(args)...);
+  }
+};
+
+template <typename NumberType, class ColorAssignment>
+struct ValidateColoringKernel {
+  typedef bool ResultType;
+
+  template <unsigned NDIM>
+  static bool Run(const ColorAssignment& coloring) {
+    return ValidateColoringFixed<NDIM, NumberType>(coloring);
+  }
+
+  static bool RunDynamic(unsigned ndim, const ColorAssignment& coloring) {
+    return ValidateColoring(coloring, NumberType(ndim));
+  }
+};
+
+// ValidateColoring through the compile-time specialization for ndim
+template <typename NumberType, class ColorAssignment>
+bool DispatchValidateColoring(const ColorAssignment& coloring,
+                              NumberType ndim) {
+  typedef ValidateColoringKernel<NumberType, ColorAssignment> Kernel;
+  return DimensionDispatch<Kernel, kMinFixedDimension,
+                           GetMaxFixedDimension<NumberType>()>::Run(ndim,
+                                                                   coloring);
+}
+
+// Vectorized validation kernels for a materialized coloring of 32-bit colors.
+// Each iteration checks a batch of consecutive states: neighbor states are
+// formed by XOR with the per-dimension masks, their colors are gathered, the
+// one-hot color masks are OR-ed together and the lanes are popcounted.
+enum class SimdBackend { kScalar, kAVX2, kAVX512 };
+
+inline const char* GetSimdBackendName(SimdBackend backend) {
+  switch (backend) {
+    case SimdBackend::kAVX2:
+      return "avx2";
+    case SimdBackend::kAVX512:
+      return "avx512";
+    default:
+      return "scalar";
+  }
+}
+
+// return the widest backend supported by the cpu we are running on
+inline SimdBackend GetBestSimdBackend() {
+#ifdef DEVILS_CHECKERBOARD_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512vpopcntdq")) {
+    return SimdBackend::kAVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdBackend::kAVX2;
+  }
+#endif
+  return SimdBackend::kScalar;
+}
+
+// return the first state in [begin, end) whose closed neighborhood does not
+// see all colors, or end if there is none
+inline uint32_t FindFirstViolationScalar(const uint32_t* coloring,
+                                         uint32_t ndim, uint32_t begin,
+                                         uint32_t end) {
+  for (uint32_t current_state = begin; current_state < end; ++current_state) {
+    if (PopCount(GetColorsSeen(coloring, ndim, current_state)) != ndim) {
+      return current_state;
+    }
+  }
+  return end;
+}
+
+#ifdef DEVILS_CHECKERBOARD_X86_SIMD
+// AVX2 has no vector popcount, so count the bits of each 32-bit lane with a
+// nibble lookup table
+__attribute__((target("avx2"))) inline __m256i PopCountAVX2(__m256i value) {
+  const __m256i lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0F);
+  __m256i lo = _mm256_and_si256(value, low_mask);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(value, 4), low_mask);
+  __m256i byte_counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                        _mm256_shuffle_epi8(lookup, hi));
+  __m256i word_counts =
+      _mm256_maddubs_epi16(byte_counts, _mm256_set1_epi8(0x01));
+  return _mm256_madd_epi16(word_counts, _mm256_set1_epi16(0x01));
+}
+
+// 8 states per iteration
+__attribute__((target("avx2"))) inline uint32_t FindFirstViolationAVX2(
+    const uint32_t* coloring, uint32_t ndim, uint32_t begin, uint32_t end) {
+  const int* base_ptr = reinterpret_cast<const int*>(coloring);
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i n_colors = _mm256_set1_epi32(ndim);
+
+  uint32_t current_state = begin;
+  for (; current_state + 8 <= end; current_state += 8) {
+    __m256i state = _mm256_add_epi32(_mm256_set1_epi32(current_state), lane);
+    __m256i colors = _mm256_i32gather_epi32(base_ptr, state, 4);
+    __m256i colors_seen = _mm256_sllv_epi32(one, colors);
+
+    for (uint32_t i = 0; i < ndim; ++i) {
+      __m256i neighbor_state =
+          _mm256_xor_si256(state, _mm256_set1_epi32(1u << i));
+      colors = _mm256_i32gather_epi32(base_ptr, neighbor_state, 4);
+      colors_seen =
+          _mm256_or_si256(colors_seen, _mm256_sllv_epi32(one, colors));
+    }
+
+    __m256i ok = _mm256_cmpeq_epi32(PopCountAVX2(colors_seen), n_colors);
+    uint32_t failed = ~_mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0xFF;
+    if (failed) {
+      return current_state + __builtin_ctz(failed);
+    }
+  }
+
+  return FindFirstViolationScalar(coloring, ndim, current_state, end);
+}
+
+// 16 states per iteration, using the AVX-512 vector popcount
+__attribute__((target("avx512f,avx512vpopcntdq"))) inline uint32_t
+FindFirstViolationAVX512(const uint32_t* coloring, uint32_t ndim,
+                         uint32_t begin, uint32_t end) {
+  const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                                         12, 13, 14, 15);
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i n_colors = _mm512_set1_epi32(ndim);
+
+  uint32_t current_state = begin;
+  for (; current_state + 16 <= end; current_state += 16) {
+    __m512i state = _mm512_add_epi32(_mm512_set1_epi32(current_state), lane);
+    __m512i colors = _mm512_i32gather_epi32(state, coloring, 4);
+    __m512i colors_seen = _mm512_sllv_epi32(one, colors);
+
+    for (uint32_t i = 0; i < ndim; ++i) {
+      __m512i neighbor_state =
+          _mm512_xor_si512(state, _mm512_set1_epi32(1u << i));
+      colors = _mm512_i32gather_epi32(neighbor_state, coloring, 4);
+      colors_seen =
+          _mm512_or_si512(colors_seen, _mm512_sllv_epi32(one, colors));
+    }
+
+    __mmask16 failed =
+        _mm512_cmpneq_epi32_mask(_mm512_popcnt_epi32(colors_seen), n_colors);
+    if (failed) {
+      return current_state + __builtin_ctz(failed);
+    }
+  }
+
+  return FindFirstViolationScalar(coloring, ndim, current_state, end);
+}
+#endif
+
+// return the first failing state in [begin, end) using the requested backend.
+// The vector kernels index the coloring with signed 32-bit gathers and shift
+// by color, so they require ndim < 32.
+inline uint32_t FindFirstViolation(const uint32_t* coloring, uint32_t ndim,
+                                   uint32_t begin, uint32_t end,
+                                   SimdBackend backend) {
+#ifdef DEVILS_CHECKERBOARD_X86_SIMD
+  if (ndim < 32) {
+    switch (backend) {
+      case SimdBackend::kAVX512:
+        return FindFirstViolationAVX512(coloring, ndim, begin, end);
+      case SimdBackend::kAVX2:
+        return FindFirstViolationAVX2(coloring, ndim, begin, end);
+      default:
+        break;
+    }
+  }
+#endif
+  return FindFirstViolationScalar(coloring, ndim, begin, end);
+}
+
+inline bool ValidateColoring(const std::vector<uint32_t>& coloring,
+                             uint32_t ndim, SimdBackend backend) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  assert(coloring.size() == GetNumberOfStates<uint32_t>(ndim));
+  uint32_t n_states = GetNumberOfStates<uint32_t>(ndim);
+  uint32_t failed_state =
+      FindFirstViolation(coloring.data(), ndim, 0, n_states, backend);
+  uint64_t n_visited = std::min<uint64_t>(failed_state + UINT64_C(1), n_states);
+  DEVILS_CHECKERBOARD_COUNT(states_visited, n_visited);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, n_visited * (ndim + 1));
+  if (failed_state < n_states) {
+    ReportViolation(ndim, failed_state,
+                    GetColorsSeen(coloring, ndim, failed_state));
+    return false;
+  }
+  return true;
+}
+
+// Same with the states split into num_threads contiguous ranges. Each worker
+// runs the backend kernel over its range in chunks and stops once it passes
+// the lowest failing state found so far, so the state reported is the same
+// one the serial version would report.
+inline bool ParallelValidateColoring(const std::vector<uint32_t>& coloring,
+                                     uint32_t ndim, unsigned num_threads,
+                                     SimdBackend backend) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  static const uint32_t kChunkStates = 1 << 16;
+  assert(coloring.size() == GetNumberOfStates<uint32_t>(ndim));
+  uint32_t n_states = GetNumberOfStates<uint32_t>(ndim);
+  num_threads = std::max(1u, std::min<unsigned>(num_threads, n_states));
+
+  // lowest failing state found by any worker, n_states if none
+  std::atomic<uint32_t> first_failure(n_states);
+
+  auto worker = [&](uint32_t begin, uint32_t end) {
+    uint32_t current_state = begin;
+    while (current_state < end &&
+           current_state < first_failure.load(std::memory_order_relaxed)) {
+      uint32_t chunk_end = std::min(end, current_state + kChunkStates);
+      uint32_t failed_state = FindFirstViolation(
+          coloring.data(), ndim, current_state, chunk_end, backend);
+      if (failed_state < chunk_end) {
+        uint32_t prev = first_failure.load();
+        while (failed_state < prev &&
+               !first_failure.compare_exchange_weak(prev, failed_state)) {
+        }
+        current_state = failed_state + 1;
+        break;
+      }
+      current_state = chunk_end;
+    }
+    DEVILS_CHECKERBOARD_COUNT(states_visited, current_state - begin);
+    DEVILS_CHECKERBOARD_COUNT(neighbor_lookups,
+                              uint64_t(current_state - begin) * (ndim + 1));
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  uint32_t states_per_thread = n_states / num_threads;
+  uint32_t remainder = n_states % num_threads;
+  uint32_t begin = 0;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    uint32_t end = begin + states_per_thread + (i < remainder ? 1 : 0);
+    threads.emplace_back(worker, begin, end);
+    begin = end;
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  uint32_t failed_state = first_failure.load();
+  if (failed_state < n_states) {
+    ReportViolation(ndim, failed_state,
+                    GetColorsSeen(coloring, ndim, failed_state));
+    return false;
+  }
+  return true;
+}
+
+// materialized 32-bit colorings are validated with the best available kernel
+inline bool ValidateColoring(const std::vector<uint32_t>& coloring,
+                             uint32_t ndim) {
+  static const SimdBackend kBackend = GetBestSimdBackend();
+  return ValidateColoring(coloring, ndim, kBackend);
+}
+
+static const std::string kFormat2 =
+    "\
+  (10) o ----- o (11)   (00) : {0:d} \n\
+       |       |        (01) : {1:d} \n\
+       |       |        (10) : {2:d} \n\
+  (00) o-------o (01)   (11) : {3:d} \n\
+";
+
+static const std::string kFormat3 =
+    "\
+\n\
+    (110) o-------o (111)   (000) : {0:d} \n\
+         /|      /|         (001) : {1:d} \n\
+ (010)  / |     / |         (010) : {2:d} \n\
+       o ----- o  o (101)   (011) : {3:d} \n\
+       | /     | /          (100) : {4:d} \n\
+       |/      |/           (101) : {5:d} \n\
+ (000) o-------o (001)      (110) : {6:d} \n\
+                            (111) : {7:d} \n\
+";
+
+template <typename NumberType, class ColorAssignment>
+void PrintColoring(std::ostream& out, const ColorAssignment& coloring,
+                   NumberType ndim) {
+  switch (ndim) {
+    case 2: {
+      fmt::print(out, kFormat2, coloring[0], coloring[1], coloring[2],
+                 coloring[3]);
+      break;
+    }
+
+    case 3: {
+      fmt::print(out, kFormat3, coloring[0], coloring[1], coloring[2],
+                 coloring[3], coloring[4], coloring[5], coloring[6],
+                 coloring[7]);
+      break;
+    }
+
+    case 4: {
+      break;
+    }
+
+    default:
+      out << "No visualization for dimension " << ndim << "\n";
+  }
+}
+
+// Order in which GenerateColoring assigns colors: by increasing number of set
+// bits, and by decreasing value within the same number of set bits
+template <typename NumberType>
+struct TopologicalCompare {
+  bool operator()(NumberType a, NumberType b) {
+    // Same depth, return sorted order
+    if (PopCount(a) == PopCount(b)) {
+      return a > b;
+      // Different depth, handle lower depth first
+    } else {
+      return PopCount(a) < PopCount(b);
+    }
+  }
+};
+
+// return the next larger number with the same number of set bits
+// (Gosper's hack)
+template <typename NumberType>
+inline NumberType NextSamePopCount(NumberType value) {
+  NumberType lowest = value & (~value + 1);
+  NumberType ripple = value + lowest;
+  return (((ripple ^ value) >> 2) >> CountTrailingZeros(lowest)) | ripple;
+}
+
+// Visit all states with layer bits set, in the order of TopologicalCompare
+// (decreasing value). These are the complements of the numbers with
+// (ndim - layer) bits set, taken in increasing order.
+template <typename NumberType, class Dimension, class Visitor>
+void ForEachStateInLayer(Dimension ndim, NumberType layer, Visitor& visit) {
+  NumberType all_states = GetNumberOfStates<NumberType>(ndim) - 1;
+  NumberType n_unset = ndim - layer;
+  if (n_unset == 0) {
+    visit(all_states);
+    return;
+  }
+
+  for (NumberType complement = (NumberType(0x01) << n_unset) - 1;
+       complement <= all_states; complement = NextSamePopCount(complement)) {
+    visit(all_states ^ complement);
+  }
+}
+
+// Visit all states in the order of TopologicalCompare, one popcount layer at a
+// time.
+template <typename NumberType, class Dimension, class Visitor>
+void ForEachStateTopological(Dimension ndim, Visitor visit) {
+  for (NumberType layer = 0; layer <= ndim; ++layer) {
+    ForEachStateInLayer<NumberType>(ndim, layer, visit);
+  }
+}
+
+// Cycle over colors in topological order. Dimension is either NumberType or a
+// std::integral_constant, in which case all loops over dimensions have a
+// constant trip count.
+template <typename NumberType, class Dimension>
+std::vector<NumberType> GenerateColoringImpl(Dimension ndim) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseGenerate);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType num_colors = GetNumberOfColors<NumberType>(ndim);
+  NumberType next_color = 0;
+
+  std::vector<NumberType> result(n_states);
+  ForEachStateTopological<NumberType>(ndim, [&](NumberType current_state) {
+    assert(current_state < result.size());
+    result[current_state] = next_color;
+    next_color = (next_color + 1) % num_colors;
+  });
+
+  DEVILS_CHECKERBOARD_COUNT(states_emitted, n_states);
+  DEVILS_CHECKERBOARD_COUNT(bytes_allocated, n_states * sizeof(NumberType));
+  return result;
+}
+
+template <typename NumberType>
+std::vector<NumberType> GenerateColoring(NumberType ndim) {
+  return GenerateColoringImpl<NumberType>(ndim);
+}
+
+// Same as GenerateColoring, but the coloring is written into a packed
+// buffer whose storage is reused across calls
+template <typename NumberType>
+void GenerateColoring(NumberType ndim, PackedColoring<NumberType>* result) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseGenerate);
+  NumberType num_colors = GetNumberOfColors<NumberType>(ndim);
+  NumberType next_color = 0;
+
+  result->Reset(GetNumberOfStates<NumberType>(ndim),
+                GetBitsPerColor(num_colors));
+  ForEachStateTopological<NumberType>(ndim, [&](NumberType current_state) {
+    result->SetColor(current_state, next_color);
+    next_color = (next_color + 1) % num_colors;
+  });
+  DEVILS_CHECKERBOARD_COUNT(states_emitted, result->size());
+}
+
+// Same as GenerateColoring with the dimension fixed at compile time
+template <unsigned NDIM, typename NumberType>
+std::vector<NumberType> GenerateColoringFixed() {
+  return GenerateColoringImpl<NumberType>(
+      std::integral_constant<NumberType, NDIM>());
+}
+
+template <typename NumberType>
+struct GenerateColoringKernel {
+  typedef std::vector<NumberType> ResultType;
+
+  template <unsigned NDIM>
+  static ResultType Run() {
+    return GenerateColoringFixed<NDIM, NumberType>();
+  }
+
+  static ResultType RunDynamic(unsigned ndim) {
+    return GenerateColoring<NumberType>(ndim);
+  }
+};
+
+// GenerateColoring through the compile-time specialization for ndim
+template <typename NumberType>
+std::vector<NumberType> DispatchGenerateColoring(NumberType ndim) {
+  typedef GenerateColoringKernel<NumberType> Kernel;
+  return DimensionDispatch<Kernel, kMinFixedDimension,
+                           GetMaxFixedDimension<NumberType>()>::Run(ndim);
+}
+
+// return the binomial coefficient C(n, k) for n <= 64, which fits in 64 bits
+inline uint64_t Binomial(unsigned n, unsigned k) {
+  struct Table {
+    Table() {
+      for (unsigned i = 0; i <= 64; ++i) {
+        values[i][0] = 1;
+        for (unsigned j = 1; j <= i; ++j) {
+          values[i][j] = values[i - 1][j - 1] + (j < i ? values[i - 1][j] : 0);
+        }
+        for (unsigned j = i + 1; j <= 64; ++j) {
+          values[i][j] = 0;
+        }
+      }
+    }
+    uint64_t values[65][65];
+  };
+  static const Table kTable;
+
+  assert(n <= 64);
+  return k <= n ? kTable.values[n][k] : 0;
+}
+
+// return the position of state within its popcount layer in the order of
+// TopologicalCompare. Numbers with the same popcount in increasing order are
+// in colexicographic order of their set bits, so this is the complement of
+// the combinatorial number system index sum_j C(p_j, j + 1).
+template <typename NumberType>
+uint64_t GetLayerRank(NumberType state, NumberType ndim) {
+  unsigned layer = 0;
+  uint64_t colex_rank = 0;
+  for (NumberType bits = state; bits; bits &= bits - 1) {
+    ++layer;
+    colex_rank += Binomial(CountTrailingZeros(bits), layer);
+  }
+  return Binomial(ndim, layer) - 1 - colex_rank;
+}
+
+// return the number with n_set bits set whose combinatorial number system
+// index is colex_rank, the inverse of sum_j C(p_j, j + 1)
+template <typename NumberType>
+NumberType UnrankColex(uint64_t colex_rank, unsigned n_set) {
+  NumberType value = 0;
+  for (unsigned j = n_set; j > 0; --j) {
+    // largest position p with C(p, j) <= colex_rank
+    unsigned position = j - 1;
+    while (Binomial(position + 1, j) <= colex_rank) {
+      ++position;
+    }
+    colex_rank -= Binomial(position, j);
+    value |= NumberType(0x01) << position;
+  }
+  return value;
+}
+
+// Random-access view of the GenerateColoring coloring, computed in O(ndim)
+// per lookup without materializing it: the color of a state is its position
+// in the topological order modulo the number of colors, and that position is
+// the number of states in lower layers plus its rank within its own layer.
+template <typename NumberType>
+struct GreedyColorOracle {
+  GreedyColorOracle(NumberType ndim)
+      : ndim_(ndim),
+        n_colors_(GetNumberOfColors<NumberType>(ndim)),
+        layer_offsets_(ndim + 1) {
+    assert(ndim > 0 && ndim < sizeof(NumberType) * 8);
+    // offsets are kept modulo the number of colors
+    uint64_t offset = 0;
+    for (NumberType layer = 0; layer <= ndim; ++layer) {
+      layer_offsets_[layer] = offset;
+      offset = (offset + Binomial(ndim, layer)) % n_colors_;
+    }
+  }
+
+  NumberType operator[](NumberType state) const {
+    assert(state < GetNumberOfStates<NumberType>(ndim_));
+    uint64_t rank = GetLayerRank(state, ndim_) % n_colors_;
+    return (layer_offsets_[PopCount(state)] + rank) % n_colors_;
+  }
+
+  NumberType ndim_;
+  NumberType n_colors_;
+  std::vector<uint64_t> layer_offsets_;
+};
+
+// Generator which yields (state, color) pairs of the GenerateColoring
+// coloring in topological order without materializing it. Only the current
+// position in the layer enumeration is kept.
+template <typename NumberType>
+struct TopologicalColoringStream {
+  TopologicalColoringStream(NumberType ndim)
+      : ndim_(ndim),
+        all_states_(GetNumberOfStates<NumberType>(ndim) - 1),
+        num_colors_(GetNumberOfColors<NumberType>(ndim)),
+        next_color_(0),
+        layer_(0) {
+    StartLayer();
+  }
+
+  // produce the next pair, return false once all states have been produced
+  bool Next(NumberType* state, NumberType* color) {
+    if (layer_ > ndim_) {
+      return false;
+    }
+
+    *state = all_states_ ^ complement_;
+    *color = next_color_;
+    next_color_ = (next_color_ + 1) % num_colors_;
+
+    if (complement_ == 0) {
+      ++layer_;
+      StartLayer();
+    } else {
+      complement_ = NextSamePopCount(complement_);
+      if (complement_ > all_states_) {
+        ++layer_;
+        StartLayer();
+      }
+    }
+    return true;
+  }
+
+  // past the top layer the stream is done and there is no first state
+  void StartLayer() {
+    if (layer_ > ndim_) {
+      complement_ = 0;
+      return;
+    }
+    NumberType n_unset = ndim_ - layer_;
+    complement_ = n_unset ? (NumberType(0x01) << n_unset) - 1 : 0;
+  }
+
+  NumberType ndim_;
+  NumberType all_states_;
+  NumberType num_colors_;
+  NumberType next_color_;
+  NumberType layer_;
+  NumberType complement_;
+};
+
+// Validates a coloring that arrives as (state, color) pairs in topological
+// order. Neighbors of a state are in the adjacent popcount layers, so only
+// three layers are kept, each as one byte per state indexed by GetLayerRank.
+// A layer is checked once the layer after it is complete, and the first
+// failure is reported in topological order rather than state order.
+template <typename NumberType>
+struct StreamingValidator {
+  StreamingValidator(NumberType ndim)
+      : ndim_(ndim),
+        layer_(0),
+        is_valid_(true),
+        peak_window_size_(0),
+        window_(3) {
+    assert(GetNumberOfColors<NumberType>(ndim) <= 0xFF);
+  }
+
+  void Add(NumberType state, NumberType color) {
+    NumberType layer = PopCount(state);
+    if (layer != layer_) {
+      assert(layer == layer_ + 1);
+      if (layer_ > 0) {
+        CheckLayer(layer_ - 1);
+      }
+      layer_ = layer;
+      GetLayer(layer_).clear();
+    }
+
+    std::vector<uint8_t>& colors = GetLayer(layer_);
+    assert(GetLayerRank(state, ndim_) == colors.size());
+    colors.push_back(static_cast<uint8_t>(color));
+
+    uint64_t window_size =
+        window_[0].size() + window_[1].size() + window_[2].size();
+    if (window_size > peak_window_size_) {
+      peak_window_size_ = window_size;
+    }
+  }
+
+  // check the remaining layers, return true if no state failed
+  bool Finish() {
+    assert(layer_ == ndim_);
+    if (layer_ > 0) {
+      CheckLayer(layer_ - 1);
+    }
+    CheckLayer(layer_);
+    DEVILS_CHECKERBOARD_PEAK(peak_frontier_states, peak_window_size_);
+    return is_valid_;
+  }
+
+  std::vector<uint8_t>& GetLayer(NumberType layer) {
+    return window_[layer % 3];
+  }
+
+  // return the color of a state in layer, which must be in the window
+  NumberType GetColor(NumberType layer, uint64_t colex_rank) {
+    return GetLayer(layer)[Binomial(ndim_, layer) - 1 - colex_rank];
+  }
+
+  void CheckLayer(NumberType layer) {
+    if (!is_valid_) {
+      return;
+    }
+
+    // set bit positions of a state, with prefix and suffix sums of their
+    // combinatorial number system terms for the different neighbor layers
+    std::vector<unsigned> bits(ndim_);
+    std::vector<uint64_t> own_prefix(ndim_ + 1);
+    std::vector<uint64_t> down_suffix(ndim_ + 1);
+    std::vector<uint64_t> up_suffix(ndim_ + 1);
+    NumberType n_colors = ndim_;
+
+    NumberType rank = 0;
+    auto check_state = [&](NumberType state) {
+      NumberType colors_seen = 0;
+      Set(&colors_seen, NumberType(GetLayer(layer)[rank++])) = 1;
+
+      NumberType n_set = 0;
+      for (NumberType value = state; value; value &= value - 1) {
+        bits[n_set++] = CountTrailingZeros(value);
+      }
+      own_prefix[0] = 0;
+      for (NumberType j = 0; j < n_set; ++j) {
+        own_prefix[j + 1] = own_prefix[j] + Binomial(bits[j], j + 1);
+      }
+      down_suffix[n_set] = 0;
+      up_suffix[n_set] = 0;
+      for (NumberType j = n_set; j > 0; --j) {
+        down_suffix[j - 1] = down_suffix[j] + Binomial(bits[j - 1], j - 1);
+        up_suffix[j - 1] = up_suffix[j] + Binomial(bits[j - 1], j + 1);
+      }
+
+      // clearing the m-th set bit moves every higher set bit down one index
+      for (NumberType m = 0; m < n_set; ++m) {
+        uint64_t colex_rank = own_prefix[m] + down_suffix[m + 1];
+        Set(&colors_seen, GetColor(layer - 1, colex_rank)) = 1;
+      }
+
+      // setting a clear bit moves every higher set bit up one index
+      NumberType below = 0;
+      for (NumberType i = 0; i < ndim_; ++i) {
+        if (below < n_set && bits[below] == i) {
+          ++below;
+          continue;
+        }
+        uint64_t colex_rank =
+            own_prefix[below] + Binomial(i, below + 1) + up_suffix[below];
+        Set(&colors_seen, GetColor(layer + 1, colex_rank)) = 1;
+      }
+
+      if (is_valid_ && PopCount(colors_seen) != n_colors) {
+        ReportViolation(ndim_, state, colors_seen);
+        is_valid_ = false;
+      }
+    };
+    ForEachStateInLayer<NumberType>(ndim_, layer, check_state);
+    DEVILS_CHECKERBOARD_COUNT(states_visited, rank);
+    DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, rank * (ndim_ + 1));
+  }
+
+  NumberType ndim_;
+  NumberType layer_;
+  bool is_valid_;
+  uint64_t peak_window_size_;
+  std::vector<std::vector<uint8_t>> window_;
+};
+
+// Writes (state, color) pairs as text lines, buffered in memory and flushed
+// to the stream in large blocks
+struct ColoringTextSink {
+  ColoringTextSink(std::ostream& out) : out_(out) {}
+
+  ~ColoringTextSink() {
+    Flush();
+  }
+
+  template <typename NumberType>
+  void Add(NumberType state, NumberType color) {
+    buffer_ << state << ' ' << color << '\n';
+    if (buffer_.size() > kFlushSize) {
+      Flush();
+    }
+  }
+
+  void Flush() {
+    out_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+  static const size_t kFlushSize = 1 << 16;
+
+  std::ostream& out_;
+  fmt::MemoryWriter buffer_;
+};
+
+// Feed the GenerateColoring coloring to sink.Add(state, color) in topological
+// order without materializing it
+template <typename NumberType, class Sink>
+void StreamColoring(NumberType ndim, Sink& sink) {
+  TopologicalColoringStream<NumberType> stream(ndim);
+  NumberType state, color;
+  while (stream.Next(&state, &color)) {
+    sink.Add(state, color);
+  }
+}
+
+// On-disk layout of a coloring file: this header followed by num_words
+// little-endian 64-bit words holding the colors packed as in PackedColoring
+struct ColoringFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t ndim;
+  uint32_t bits_per_color;
+  uint32_t reserved;
+  uint64_t num_words;
+};
+
+static const char kColoringFileMagic[8] = {'D', 'C', 'C', 'O',
+                                           'L', 'O', 'R', '\0'};
+static const uint32_t kColoringFileVersion = 1;
+
+template <typename NumberType>
+bool WriteColoringFile(const std::string& path,
+                       const PackedColoring<NumberType>& coloring,
+                       NumberType ndim) {
+  assert(coloring.size() == GetNumberOfStates<NumberType>(ndim));
+  ColoringFileHeader header;
+  std::memcpy(header.magic, kColoringFileMagic, sizeof(header.magic));
+  header.version = kColoringFileVersion;
+  header.ndim = static_cast<uint32_t>(ndim);
+  header.bits_per_color = coloring.bits_per_color_;
+  header.reserved = 0;
+  header.num_words = coloring.words_.size();
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(coloring.words_.data()),
+            coloring.words_.size() * sizeof(uint64_t));
+  out.close();
+  if (!out) {
+    fmt::print(std::cerr, "Failed to write coloring file {}\n", path);
+    return false;
+  }
+  return true;
+}
+
+// pack any coloring and write it out
+template <typename NumberType, class ColorAssignment>
+bool WriteColoringFile(const std::string& path,
+                       const ColorAssignment& coloring, NumberType ndim) {
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  PackedColoring<NumberType> packed(
+      n_states, GetBitsPerColor(GetNumberOfColors<NumberType>(ndim)));
+  for (NumberType state = 0; state < n_states; ++state) {
+    packed.SetColor(state, coloring[state]);
+  }
+  return WriteColoringFile(path, packed, ndim);
+}
+
+// A coloring file mapped read-only into memory. The colors are read in place
+// from the mapping, so opening is O(1) regardless of the dimension.
+template <typename NumberType>
+struct MappedColoring {
+  MappedColoring()
+      : ndim_(0), data_(nullptr), size_(0), view_(nullptr, 1) {}
+
+  ~MappedColoring() {
+    Close();
+  }
+
+  MappedColoring(const MappedColoring&) = delete;
+  MappedColoring& operator=(const MappedColoring&) = delete;
+
+  bool Open(const std::string& path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      fmt::print(std::cerr, "Failed to open coloring file {}\n", path);
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+        static_cast<size_t>(info.st_size) < sizeof(ColoringFileHeader)) {
+      fmt::print(std::cerr, "Coloring file {} is truncated\n", path);
+      close(fd);
+      return false;
+    }
+
+    size_ = info.st_size;
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data_ == MAP_FAILED) {
+      fmt::print(std::cerr, "Failed to map coloring file {}\n", path);
+      data_ = nullptr;
+      return false;
+    }
+
+    const ColoringFileHeader* header = GetHeader();
+    if (std::memcmp(header->magic, kColoringFileMagic,
+                    sizeof(header->magic)) != 0 ||
+        header->version != kColoringFileVersion ||
+        header->ndim >= sizeof(NumberType) * 8 ||
+        header->bits_per_color !=
+            GetBitsPerColor(GetNumberOfColors<uint64_t>(header->ndim)) ||
+        header->num_words !=
+            GetNumberOfPackedWords(GetNumberOfStates<uint64_t>(header->ndim),
+                                   header->bits_per_color) ||
+        size_ < sizeof(ColoringFileHeader) +
+                    header->num_words * sizeof(uint64_t)) {
+      fmt::print(std::cerr, "{} is not a valid coloring file\n", path);
+      Close();
+      return false;
+    }
+
+    ndim_ = header->ndim;
+    view_ = PackedColorView<NumberType>(
+        reinterpret_cast<const uint64_t*>(header + 1), header->bits_per_color);
+    return true;
+  }
+
+  void Close() {
+    if (data_) {
+      munmap(data_, size_);
+      data_ = nullptr;
+      size_ = 0;
+    }
+  }
+
+  const ColoringFileHeader* GetHeader() const {
+    return static_cast<const ColoringFileHeader*>(data_);
+  }
+
+  NumberType operator[](NumberType state) const {
+    assert(state < GetNumberOfStates<NumberType>(ndim_));
+    return view_[state];
+  }
+
+  NumberType ndim_;
+  void* data_;
+  size_t size_;
+  PackedColorView<NumberType> view_;
+};
+
+// Keeps, for every state, how often each color occurs in its closed
+// neighborhood. Recoloring one state only changes the counts of the ndim + 1
+// states in its closed neighborhood, so the number of violating states is
+// updated in O(ndim) per recolor and can be queried in O(1).
+template <typename NumberType>
+struct IncrementalValidator {
+  template <class ColorAssignment>
+  IncrementalValidator(const ColorAssignment& coloring, NumberType ndim)
+      : ndim_(ndim),
+        n_colors_(GetNumberOfColors<NumberType>(ndim)),
+        n_violations_(0) {
+    assert(ndim < 0xFF && n_colors_ <= 0xFF);
+    NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+    colors_.resize(n_states);
+    for (NumberType state = 0; state < n_states; ++state) {
+      assert(coloring[state] < n_colors_);
+      colors_[state] = static_cast<uint8_t>(coloring[state]);
+    }
+
+    counts_.assign(n_states * n_colors_, 0);
+    n_missing_.assign(n_states, 0);
+    for (NumberType state = 0; state < n_states; ++state) {
+      uint8_t* counts = &counts_[state * n_colors_];
+      ++counts[colors_[state]];
+      for (NumberType i = 0; i < ndim; ++i) {
+        ++counts[colors_[state ^ (NumberType(0x01) << i)]];
+      }
+
+      for (NumberType color = 0; color < n_colors_; ++color) {
+        n_missing_[state] += counts[color] == 0;
+      }
+      n_violations_ += n_missing_[state] > 0;
+    }
+  }
+
+  // change the color of state, updating its closed neighborhood
+  void Recolor(NumberType state, NumberType color) {
+    assert(color < n_colors_);
+    NumberType old_color = colors_[state];
+    if (color == old_color) {
+      return;
+    }
+
+    colors_[state] = static_cast<uint8_t>(color);
+    UpdateCounts(state, old_color, color);
+    for (NumberType i = 0; i < ndim_; ++i) {
+      UpdateCounts(state ^ (NumberType(0x01) << i), old_color, color);
+    }
+  }
+
+  // move one occurrence of old_color in the neighborhood of state to color
+  void UpdateCounts(NumberType state, NumberType old_color, NumberType color) {
+    uint8_t* counts = &counts_[state * n_colors_];
+    uint8_t& n_missing = n_missing_[state];
+    bool was_violating = n_missing > 0;
+    n_missing += --counts[old_color] == 0;
+    n_missing -= counts[color]++ == 0;
+    bool is_violating = n_missing > 0;
+    n_violations_ += is_violating;
+    n_violations_ -= was_violating;
+  }
+
+  // return the change in the number of violations if state were recolored
+  int64_t GetRecolorDelta(NumberType state, NumberType color) const {
+    NumberType old_color = colors_[state];
+    if (color == old_color) {
+      return 0;
+    }
+
+    int64_t delta = GetCountsDelta(state, old_color, color);
+    for (NumberType i = 0; i < ndim_; ++i) {
+      delta +=
+          GetCountsDelta(state ^ (NumberType(0x01) << i), old_color, color);
+    }
+    return delta;
+  }
+
+  // change in violations of state if one old_color became color
+  int64_t GetCountsDelta(NumberType state, NumberType old_color,
+                         NumberType color) const {
+    const uint8_t* counts = &counts_[state * n_colors_];
+    int n_missing = n_missing_[state];
+    int new_missing =
+        n_missing + (counts[old_color] == 1) - (counts[color] == 0);
+    return int64_t(new_missing > 0) - int64_t(n_missing > 0);
+  }
+
+  // number of states whose closed neighborhood is missing some color
+  NumberType GetNumberOfViolations() const {
+    return n_violations_;
+  }
+
+  bool IsValid() const {
+    return n_violations_ == 0;
+  }
+
+  // number of colors missing from the closed neighborhood of state
+  NumberType GetNumberOfMissingColors(NumberType state) const {
+    return n_missing_[state];
+  }
+
+  NumberType operator[](NumberType state) const {
+    return colors_[state];
+  }
+
+  NumberType ndim_;
+  NumberType n_colors_;
+  NumberType n_violations_;
+  std::vector<uint8_t> colors_;
+  // counts_[state * n_colors_ + color] is the number of times color occurs in
+  // the closed neighborhood of state
+  std::vector<uint8_t> counts_;
+  std::vector<uint8_t> n_missing_;
+};
+
+// A coloring produced by one of the solvers, along with its number of
+// violating states
+template <typename NumberType>
+struct ColoringSolution {
+  NumberType operator[](NumberType state) const {
+    return colors_[state];
+  }
+
+  NumberType n_violations_;
+  std::vector<uint8_t> colors_;
+};
+
+// Holds the best solution published by any solver thread. Solutions are
+// immutable once published and reference counted: a superseded solution is
+// freed as soon as the last reader that got it from Get() drops it. The slot
+// is swapped with compare-and-swap on the shared pointer.
+template <typename NumberType>
+struct BestSolutionSlot {
+  typedef std::shared_ptr<const ColoringSolution<NumberType>> SolutionPtr;
+
+  // return the current best solution or nullptr
+  SolutionPtr Get() const {
+    return std::atomic_load(&best_);
+  }
+
+  // try to make solution the best
+  bool Publish(const SolutionPtr& solution) {
+    SolutionPtr current = std::atomic_load(&best_);
+    while (!current || solution->n_violations_ < current->n_violations_) {
+      if (std::atomic_compare_exchange_weak(&best_, &current, solution)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  SolutionPtr best_;
+};
+
+struct AnnealingOptions {
+  AnnealingOptions()
+      : num_threads(std::thread::hardware_concurrency()),
+        time_budget(10.0),
+        seed(0),
+        initial_temperature(2.0),
+        final_temperature(0.05),
+        moves_per_state(32) {}
+
+  unsigned num_threads;
+  // wall-clock budget in seconds
+  double time_budget;
+  uint64_t seed;
+  double initial_temperature;
+  double final_temperature;
+  // moves per restart, in multiples of the number of states
+  double moves_per_state;
+};
+
+// Simulated annealing over single-state recolors, scored by the number of
+// violating states. Every thread runs independent restarts, starting from the
+// mirror coloring, the greedy coloring, or the best solution found so far by
+// any thread. Returns once a valid coloring is found or the time budget runs
+// out, with the best coloring reached.
+template <typename NumberType>
+ColoringSolution<NumberType> AnnealColoring(NumberType ndim,
+                                            const AnnealingOptions& options) {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point deadline =
+      Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double>(options.time_budget));
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = GetNumberOfColors<NumberType>(ndim);
+  uint64_t moves_per_restart =
+      static_cast<uint64_t>(options.moves_per_state * n_states) + 1;
+  unsigned num_threads = std::max(1u, options.num_threads);
+
+  BestSolutionSlot<NumberType> slot;
+  std::atomic<bool> done(false);
+
+  auto worker = [&](unsigned thread_index) {
+    std::mt19937_64 rng(options.seed + thread_index);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    for (uint64_t restart = 0; !done.load(std::memory_order_relaxed);
+         ++restart) {
+      typename BestSolutionSlot<NumberType>::SolutionPtr best = slot.Get();
+      uint64_t start = (restart + thread_index) % 3;
+      std::unique_ptr<IncrementalValidator<NumberType>> validator;
+      if (start == 2 && best) {
+        validator.reset(new IncrementalValidator<NumberType>(*best, ndim));
+        // do not keep it alive while annealing
+        best.reset();
+      } else if (start == 1) {
+        validator.reset(new IncrementalValidator<NumberType>(
+            GenerateColoring<NumberType>(ndim), ndim));
+      } else {
+        validator.reset(new IncrementalValidator<NumberType>(
+            MirrorTableAssignment<NumberType>(ndim), ndim));
+      }
+
+      double cooling = std::pow(
+          options.final_temperature / options.initial_temperature,
+          1.0 / static_cast<double>(moves_per_restart));
+      double temperature = options.initial_temperature;
+      for (uint64_t move = 0; move < moves_per_restart && !validator->IsValid();
+           ++move) {
+        NumberType state = rng() % n_states;
+        NumberType color = rng() % (n_colors - 1);
+        color += color >= (*validator)[state];
+        int64_t delta = validator->GetRecolorDelta(state, color);
+        if (delta <= 0 || uniform(rng) < std::exp(-delta / temperature)) {
+          validator->Recolor(state, color);
+        }
+        temperature *= cooling;
+
+        if (move % 4096 == 0 && (done.load(std::memory_order_relaxed) ||
+                                 Clock::now() > deadline)) {
+          break;
+        }
+      }
+
+      best = slot.Get();
+      if (!best || validator->GetNumberOfViolations() < best->n_violations_) {
+        std::shared_ptr<ColoringSolution<NumberType>> solution(
+            new ColoringSolution<NumberType>());
+        solution->n_violations_ = validator->GetNumberOfViolations();
+        solution->colors_ = validator->colors_;
+        best.reset();
+        slot.Publish(solution);
+      }
+
+      if (validator->IsValid() || Clock::now() > deadline) {
+        done.store(true);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker, i);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  return *slot.Get();
+}
+
+// Symmetry breaking for the exhaustive search. Every closed neighborhood has
+// ndim + 1 states and ndim colors, so exactly one color occurs twice in it.
+// Up to color permutations and bit permutations, the neighborhood of state 0
+// is then colored in one of two ways:
+//   case 0: color(0) = 0 and color(e_i) = i, the repeat involves state 0
+//   case 1: color(0) = 0, color(e_0) = 1 and color(e_i) = i for i > 0
+// If some state repeats the color of one of its neighbors, an XOR translation
+// moves it to state 0 and we are in case 0. So in case 1 the coloring can
+// additionally be required to be proper (no two neighbors share a color).
+static const unsigned kNumSymmetryCases = 2;
+
+// return the (state, color) pairs fixed by the given symmetry case
+template <typename NumberType>
+std::vector<std::pair<NumberType, NumberType>> GetSymmetryBreakingColors(
+    NumberType ndim, unsigned symmetry_case) {
+  std::vector<std::pair<NumberType, NumberType>> result;
+  result.emplace_back(0, 0);
+  for (NumberType i = 0; i < ndim; ++i) {
+    NumberType color = (i == 0 && symmetry_case == 1) ? 1 : i;
+    result.emplace_back(NumberType(0x01) << i, color);
+  }
+  return result;
+}
+
+// Partial coloring with the per-neighborhood bookkeeping needed to prune:
+// a closed neighborhood can only still see all colors if the distinct
+// colors assigned to it plus its unassigned states cover n_colors.
+template <typename NumberType>
+struct SearchState {
+  static const uint8_t kUnassigned = 0xFF;
+
+  SearchState(NumberType ndim)
+      : ndim_(ndim),
+        n_colors_(GetNumberOfColors<NumberType>(ndim)),
+        proper_(false) {
+    assert(ndim < 0xFF);
+    Reset(false);
+  }
+
+  // clear all assignments
+  void Reset(bool proper) {
+    NumberType n_states = GetNumberOfStates<NumberType>(ndim_);
+    proper_ = proper;
+    colors_.assign(n_states, kUnassigned);
+    counts_.assign(n_states * n_colors_, 0);
+    n_distinct_.assign(n_states, 0);
+    n_unassigned_.assign(n_states, static_cast<uint8_t>(ndim_ + 1));
+  }
+
+  // assign color to an unassigned state, return false and leave the state
+  // unassigned if that makes some closed neighborhood infeasible
+  bool Assign(NumberType state, NumberType color) {
+    assert(colors_[state] == kUnassigned && color < n_colors_);
+    if (proper_) {
+      for (NumberType i = 0; i < ndim_; ++i) {
+        if (colors_[state ^ (NumberType(0x01) << i)] == color) {
+          return false;
+        }
+      }
+    }
+
+    colors_[state] = static_cast<uint8_t>(color);
+    bool feasible = AddToNeighborhood(state, color);
+    for (NumberType i = 0; i < ndim_; ++i) {
+      feasible &= AddToNeighborhood(state ^ (NumberType(0x01) << i), color);
+    }
+    if (!feasible) {
+      Unassign(state);
+    }
+    return feasible;
+  }
+
+  void Unassign(NumberType state) {
+    NumberType color = colors_[state];
+    assert(color != kUnassigned);
+    RemoveFromNeighborhood(state, color);
+    for (NumberType i = 0; i < ndim_; ++i) {
+      RemoveFromNeighborhood(state ^ (NumberType(0x01) << i), color);
+    }
+    colors_[state] = kUnassigned;
+  }
+
+  // return false if the neighborhood of state cannot see all colors anymore
+  bool AddToNeighborhood(NumberType state, NumberType color) {
+    n_distinct_[state] += counts_[state * n_colors_ + color]++ == 0;
+    --n_unassigned_[state];
+    return n_distinct_[state] + n_unassigned_[state] >= n_colors_;
+  }
+
+  void RemoveFromNeighborhood(NumberType state, NumberType color) {
+    n_distinct_[state] -= --counts_[state * n_colors_ + color] == 0;
+    ++n_unassigned_[state];
+  }
+
+  NumberType operator[](NumberType state) const {
+    return colors_[state];
+  }
+
+  NumberType ndim_;
+  NumberType n_colors_;
+  bool proper_;
+  std::vector<uint8_t> colors_;
+  std::vector<uint8_t> counts_;
+  std::vector<uint8_t> n_distinct_;
+  std::vector<uint8_t> n_unassigned_;
+};
+
+template <typename NumberType>
+const uint8_t SearchState<NumberType>::kUnassigned;
+
+enum class SearchStatus { kFound, kExhausted, kPaused };
+
+// Depth-first search for a valid coloring, assigning colors to states in the
+// order of TopologicalCompare. The stack is explicit so that a search can be
+// paused after a node budget and resumed, and so that it can be restricted to
+// the subtree below some prefix of the order.
+template <typename NumberType>
+struct ExhaustiveSearch {
+  ExhaustiveSearch(NumberType ndim)
+      : ndim_(ndim),
+        n_states_(GetNumberOfStates<NumberType>(ndim)),
+        n_nodes_(0),
+        state_(ndim),
+        base_depth_(0),
+        depth_(0) {
+    order_.reserve(n_states_);
+    ForEachStateTopological<NumberType>(
+        ndim, [this](NumberType state) { order_.push_back(state); });
+    next_color_.assign(n_states_ + 1, 0);
+  }
+
+  // Reset to the root of a symmetry case and descend along prefix, the colors
+  // of the states following the fixed neighborhood of state 0. Return false
+  // if the root is already infeasible.
+  bool Start(unsigned symmetry_case,
+             const std::vector<uint8_t>& prefix = std::vector<uint8_t>()) {
+    symmetry_case_ = symmetry_case;
+    state_.Reset(symmetry_case == 1);
+    depth_ = 0;
+    if (symmetry_case == 1 && state_.n_colors_ < 2) {
+      return false;
+    }
+
+    // state 0 and its neighbors come first in topological order
+    for (const auto& fixed :
+         GetSymmetryBreakingColors<NumberType>(ndim_, symmetry_case)) {
+      assert(PopCount(order_[depth_]) <= 1);
+      ++depth_;
+      if (!state_.Assign(fixed.first, fixed.second)) {
+        return false;
+      }
+    }
+    fixed_depth_ = depth_;
+    for (uint8_t color : prefix) {
+      if (!state_.Assign(order_[depth_], color)) {
+        return false;
+      }
+      next_color_[depth_] = color + 1;
+      ++depth_;
+    }
+
+    base_depth_ = depth_;
+    next_color_[depth_] = 0;
+    return true;
+  }
+
+  // Continue the search for at most max_nodes assignments. Returns kFound
+  // with the coloring in operator[], kExhausted once the subtree below the
+  // start is fully explored, or kPaused when the budget runs out.
+  SearchStatus Run(uint64_t max_nodes) {
+    for (uint64_t node = 0; node < max_nodes; ++node) {
+      if (depth_ == n_states_) {
+        return SearchStatus::kFound;
+      }
+
+      NumberType state = order_[depth_];
+      NumberType color = next_color_[depth_];
+      while (color < state_.n_colors_ && !state_.Assign(state, color)) {
+        ++color;
+      }
+      ++n_nodes_;
+
+      if (color < state_.n_colors_) {
+        next_color_[depth_] = color + 1;
+        ++depth_;
+        next_color_[depth_] = 0;
+      } else {
+        // backtrack
+        if (depth_ == base_depth_) {
+          return SearchStatus::kExhausted;
+        }
+        --depth_;
+        state_.Unassign(order_[depth_]);
+      }
+    }
+    return depth_ == n_states_ ? SearchStatus::kFound : SearchStatus::kPaused;
+  }
+
+  // Give away all untried colors at the shallowest open depth. Each one is
+  // returned as the prefix that Start() needs to search its subtree, and this
+  // search will no longer visit them. Returns false if there is nothing to
+  // give away.
+  bool Split(std::vector<std::vector<uint8_t>>* prefixes) {
+    NumberType n_colors = state_.n_colors_;
+    for (NumberType depth = base_depth_; depth < depth_; ++depth) {
+      if (next_color_[depth] < n_colors) {
+        std::vector<uint8_t> prefix;
+        for (NumberType i = fixed_depth_; i < depth; ++i) {
+          prefix.push_back(state_[order_[i]]);
+        }
+        for (NumberType color = next_color_[depth]; color < n_colors;
+             ++color) {
+          prefixes->push_back(prefix);
+          prefixes->back().push_back(static_cast<uint8_t>(color));
+        }
+        next_color_[depth] = n_colors;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Save the position of the search, for Restore() in another process.
+  // values are the symmetry case, depth, base depth and node count; word d
+  // holds the color at depth d in its high half and the next color to try
+  // at depth d in its low half.
+  void Save(uint64_t values[4], std::vector<uint64_t>* words) const {
+    values[0] = symmetry_case_;
+    values[1] = depth_;
+    values[2] = base_depth_;
+    values[3] = n_nodes_;
+    words->clear();
+    for (NumberType depth = 0; depth <= depth_ && depth < n_states_;
+         ++depth) {
+      uint64_t color = SearchState<NumberType>::kUnassigned;
+      if (depth < depth_) {
+        color = state_[order_[depth]];
+      }
+      words->push_back(color << 32 | next_color_[depth]);
+    }
+  }
+
+  // Continue from a position written by Save(). Return false if it does not
+  // describe a search of this dimension.
+  bool Restore(const uint64_t values[4], const std::vector<uint64_t>& words) {
+    NumberType depth = values[1];
+    if (values[0] >= kNumSymmetryCases || depth > n_states_ ||
+        values[2] > depth || words.size() != std::min(depth + 1, n_states_) ||
+        !Start(static_cast<unsigned>(values[0])) || fixed_depth_ > depth) {
+      return false;
+    }
+    for (NumberType i = fixed_depth_; i < depth; ++i) {
+      NumberType color = words[i] >> 32;
+      if (color >= state_.n_colors_ || !state_.Assign(order_[i], color)) {
+        return false;
+      }
+    }
+    for (NumberType i = 0; i < words.size(); ++i) {
+      next_color_[i] = words[i] & 0xFFFFFFFF;
+    }
+    depth_ = depth;
+    base_depth_ = values[2];
+    n_nodes_ = values[3];
+    return true;
+  }
+
+  NumberType operator[](NumberType state) const {
+    return state_[state];
+  }
+
+  NumberType ndim_;
+  NumberType n_states_;
+  uint64_t n_nodes_;
+  unsigned symmetry_case_;
+  SearchState<NumberType> state_;
+  std::vector<NumberType> order_;
+  // next color to try at each depth of the search
+  std::vector<NumberType> next_color_;
+  NumberType fixed_depth_;
+  NumberType base_depth_;
+  NumberType depth_;
+};
+
+// Search all symmetry cases for a valid coloring. Returns true and fills
+// solution if one exists, false if none exists.
+template <typename NumberType>
+bool SearchColoring(NumberType ndim, ColoringSolution<NumberType>* solution,
+                    uint64_t* n_nodes = nullptr) {
+  ExhaustiveSearch<NumberType> search(ndim);
+  bool found = false;
+  for (unsigned symmetry_case = 0; symmetry_case < kNumSymmetryCases && !found;
+       ++symmetry_case) {
+    if (search.Start(symmetry_case)) {
+      SearchStatus status = SearchStatus::kPaused;
+      while (status == SearchStatus::kPaused) {
+        status = search.Run(UINT64_C(1) << 20);
+      }
+      found = status == SearchStatus::kFound;
+    }
+  }
+
+  if (found) {
+    solution->n_violations_ = 0;
+    solution->colors_ = search.state_.colors_;
+  }
+  if (n_nodes) {
+    *n_nodes = search.n_nodes_;
+  }
+  return found;
+}
+
+// A subtree of the exhaustive search: the symmetry case and the colors of
+// the states after the fixed neighborhood of state 0
+struct SearchTask {
+  unsigned symmetry_case;
+  std::vector<uint8_t> prefix;
+};
+
+// Double-ended task queue of one worker. The owner pushes and pops at the
+// back, idle workers steal the oldest (and typically largest) subtrees from
+// the front.
+struct SearchTaskQueue {
+  void Push(SearchTask&& task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+
+  bool Pop(SearchTask* task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = std::move(tasks_.back());
+    tasks_.pop_back();
+    return true;
+  }
+
+  bool Steal(SearchTask* task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = std::move(tasks_.front());
+    tasks_.pop_front();
+    return true;
+  }
+
+  bool IsEmpty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.empty();
+  }
+
+  std::mutex mutex_;
+  std::deque<SearchTask> tasks_;
+};
+
+// Same as SearchColoring, with subtrees scheduled over num_threads workers by
+// work stealing. Every worker owns its ExhaustiveSearch, so pruning state is
+// never shared. While some worker is idle, busy workers split their
+// shallowest open subtree into tasks on their own queue. Idle workers sleep
+// until tasks are queued or the search ends.
+template <typename NumberType>
+bool ParallelSearchColoring(NumberType ndim, unsigned num_threads,
+                            ColoringSolution<NumberType>* solution,
+                            uint64_t* n_nodes = nullptr) {
+  // assignments between checks for idle workers
+  static const uint64_t kSliceNodes = 1 << 14;
+  num_threads = std::max(1u, num_threads);
+
+  std::vector<SearchTaskQueue> queues(num_threads);
+  // tasks that were queued and are not finished yet
+  std::atomic<uint64_t> n_pending(0);
+  std::atomic<unsigned> n_idle(0);
+  std::atomic<bool> found(false);
+  std::atomic<uint64_t> total_nodes(0);
+  std::mutex solution_mutex;
+  // n_wakeups counts the events idle workers wait for: queued tasks, the
+  // solution or the last task finishing
+  std::mutex idle_mutex;
+  std::condition_variable idle_condition;
+  uint64_t n_wakeups = 0;
+  auto wake_idle = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex);
+      ++n_wakeups;
+    }
+    idle_condition.notify_all();
+  };
+
+  for (unsigned symmetry_case = 0; symmetry_case < kNumSymmetryCases;
+       ++symmetry_case) {
+    ++n_pending;
+    queues[symmetry_case % num_threads].Push(
+        SearchTask{symmetry_case, std::vector<uint8_t>()});
+  }
+
+  auto worker = [&](unsigned thread_index) {
+    ExhaustiveSearch<NumberType> search(ndim);
+    std::mt19937 rng(thread_index);
+    SearchTask task;
+    bool is_idle = false;
+
+    while (!found.load() && n_pending.load() > 0) {
+      // tasks queued after this are announced by a later wakeup
+      uint64_t wakeups_seen = 0;
+      {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        wakeups_seen = n_wakeups;
+      }
+      bool have_task = queues[thread_index].Pop(&task);
+      // try every other queue, starting at a random one
+      unsigned first_victim = rng() % num_threads;
+      for (unsigned i = 0; !have_task && i < num_threads; ++i) {
+        unsigned victim = (first_victim + i) % num_threads;
+        have_task = victim != thread_index && queues[victim].Steal(&task);
+      }
+      if (!have_task) {
+        if (!is_idle) {
+          is_idle = true;
+          ++n_idle;
+        }
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        idle_condition.wait(lock, [&]() {
+          return n_wakeups != wakeups_seen || found.load() ||
+                 n_pending.load() == 0;
+        });
+        continue;
+      }
+      if (is_idle) {
+        is_idle = false;
+        --n_idle;
+      }
+
+      SearchStatus status = SearchStatus::kExhausted;
+      if (search.Start(task.symmetry_case, task.prefix)) {
+        status = SearchStatus::kPaused;
+      }
+      while (status == SearchStatus::kPaused && !found.load()) {
+        status = search.Run(kSliceNodes);
+        if (status == SearchStatus::kPaused && n_idle.load() > 0 &&
+            queues[thread_index].IsEmpty()) {
+          std::vector<std::vector<uint8_t>> prefixes;
+          if (search.Split(&prefixes)) {
+            n_pending += prefixes.size();
+            for (std::vector<uint8_t>& prefix : prefixes) {
+              queues[thread_index].Push(
+                  SearchTask{task.symmetry_case, std::move(prefix)});
+            }
+            wake_idle();
+          }
+        }
+      }
+
+      if (status == SearchStatus::kFound) {
+        std::lock_guard<std::mutex> lock(solution_mutex);
+        if (!found.load()) {
+          solution->n_violations_ = 0;
+          solution->colors_ = search.state_.colors_;
+          found.store(true);
+        }
+      }
+      if (--n_pending == 0 || found.load()) {
+        wake_idle();
+      }
+    }
+
+    total_nodes += search.n_nodes_;
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker, i);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  if (n_nodes) {
+    *n_nodes = total_nodes.load();
+  }
+  return found.load();
+}
+
+// CNF encoding of the coloring constraint with one variable per (state,
+// color) pair: each state has exactly one color, and every closed
+// neighborhood contains every color. Optionally adds the symmetry breaking
+// of the exhaustive search, with the state 0 neighborhood fixed and the
+// properness of case 1 guarded by the literal that selects case 1.
+template <typename NumberType>
+struct CnfEncoding {
+  CnfEncoding(NumberType ndim, bool symmetry_breaking)
+      : ndim_(ndim),
+        n_states_(GetNumberOfStates<NumberType>(ndim)),
+        n_colors_(GetNumberOfColors<NumberType>(ndim)),
+        symmetry_breaking_(symmetry_breaking &&
+                           GetNumberOfColors<NumberType>(ndim) >= 2) {}
+
+  // DIMACS variable for state having color
+  uint64_t GetVariable(NumberType state, NumberType color) const {
+    return static_cast<uint64_t>(state) * n_colors_ + color + 1;
+  }
+
+  uint64_t GetNumberOfVariables() const {
+    return static_cast<uint64_t>(n_states_) * n_colors_;
+  }
+
+  uint64_t GetNumberOfClauses() const {
+    uint64_t n_clauses = n_states_;                              // >= 1 color
+    n_clauses += n_states_ * (n_colors_ * (n_colors_ - 1) / 2);  // <= 1 color
+    n_clauses += n_states_ * n_colors_;                          // coverage
+    if (symmetry_breaking_) {
+      n_clauses += ndim_ + 1;
+      n_clauses += n_states_ / 2 * ndim_ * n_colors_;
+    }
+    return n_clauses;
+  }
+
+  // Stream the clauses to clause(literals), a vector of signed DIMACS
+  // literals without the terminating 0
+  template <class ClauseSink>
+  void ForEachClause(ClauseSink clause) const {
+    std::vector<int64_t> literals;
+    for (NumberType state = 0; state < n_states_; ++state) {
+      literals.clear();
+      for (NumberType color = 0; color < n_colors_; ++color) {
+        literals.push_back(GetVariable(state, color));
+      }
+      clause(literals);
+
+      for (NumberType a = 0; a < n_colors_; ++a) {
+        for (NumberType b = a + 1; b < n_colors_; ++b) {
+          literals.clear();
+          literals.push_back(-int64_t(GetVariable(state, a)));
+          literals.push_back(-int64_t(GetVariable(state, b)));
+          clause(literals);
+        }
+      }
+
+      for (NumberType color = 0; color < n_colors_; ++color) {
+        literals.clear();
+        literals.push_back(GetVariable(state, color));
+        for (NumberType i = 0; i < ndim_; ++i) {
+          literals.push_back(
+              GetVariable(state ^ (NumberType(0x01) << i), color));
+        }
+        clause(literals);
+      }
+    }
+
+    if (!symmetry_breaking_) {
+      return;
+    }
+
+    // state 0 and e_i with i > 0 have the same color in both cases
+    auto fixed = GetSymmetryBreakingColors<NumberType>(ndim_, 0);
+    for (const auto& pair : fixed) {
+      literals.clear();
+      literals.push_back(GetVariable(pair.first, pair.second));
+      if (pair.first == 1) {
+        // e_0 selects the case
+        literals.push_back(GetVariable(1, 1));
+      }
+      clause(literals);
+    }
+
+    int64_t is_case_1 = GetVariable(1, 1);
+    for (NumberType state = 0; state < n_states_; ++state) {
+      for (NumberType i = 0; i < ndim_; ++i) {
+        NumberType neighbor_state = state ^ (NumberType(0x01) << i);
+        if (neighbor_state < state) {
+          continue;
+        }
+        for (NumberType color = 0; color < n_colors_; ++color) {
+          literals.clear();
+          literals.push_back(-is_case_1);
+          literals.push_back(-int64_t(GetVariable(state, color)));
+          literals.push_back(-int64_t(GetVariable(neighbor_state, color)));
+          clause(literals);
+        }
+      }
+    }
+  }
+
+  NumberType ndim_;
+  NumberType n_states_;
+  NumberType n_colors_;
+  bool symmetry_breaking_;
+};
+
+// Write the CNF encoding as DIMACS. The clauses are formatted into a memory
+// buffer that is flushed in large blocks, so the whole file is never held in
+// memory.
+template <typename NumberType>
+bool WriteDimacs(std::ostream& out, NumberType ndim, bool symmetry_breaking) {
+  static const size_t kFlushSize = 1 << 16;
+  CnfEncoding<NumberType> encoding(ndim, symmetry_breaking);
+  fmt::MemoryWriter buffer;
+  buffer.write("c devils checkerboard coloring, ndim = {}\n", ndim);
+  buffer.write("p cnf {} {}\n", encoding.GetNumberOfVariables(),
+               encoding.GetNumberOfClauses());
+  encoding.ForEachClause([&](const std::vector<int64_t>& literals) {
+    for (int64_t literal : literals) {
+      buffer << literal << ' ';
+    }
+    buffer << "0\n";
+    if (buffer.size() > kFlushSize) {
+      out.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  });
+  out.write(buffer.data(), buffer.size());
+  return static_cast<bool>(out);
+}
+
+enum class SatResult { kSatisfiable, kUnsatisfiable, kUnknown };
+
+// Read a solver model in the SAT competition output format ("s ..." status
+// line and "v ..." literal lines, bare literal lines are also accepted) and
+// convert it to a coloring.
+template <typename NumberType>
+SatResult ReadDimacsModel(std::istream& in, NumberType ndim,
+                          ColoringSolution<NumberType>* solution) {
+  CnfEncoding<NumberType> encoding(ndim, false);
+  NumberType n_states = encoding.n_states_;
+  solution->n_violations_ = 0;
+  solution->colors_.assign(n_states, SearchState<NumberType>::kUnassigned);
+
+  SatResult result = SatResult::kUnknown;
+  bool have_model = false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == 'c') {
+      continue;
+    }
+    if (line[0] == 's') {
+      if (line.find("UNSATISFIABLE") != std::string::npos) {
+        return SatResult::kUnsatisfiable;
+      } else if (line.find("SATISFIABLE") != std::string::npos) {
+        result = SatResult::kSatisfiable;
+      }
+      continue;
+    }
+
+    std::istringstream literals(line[0] == 'v' ? line.substr(1) : line);
+    int64_t literal;
+    while (literals >> literal) {
+      if (literal > 0 &&
+          static_cast<uint64_t>(literal) <= encoding.GetNumberOfVariables()) {
+        uint64_t variable = literal - 1;
+        solution->colors_[variable / encoding.n_colors_] =
+            static_cast<uint8_t>(variable % encoding.n_colors_);
+        have_model = true;
+      }
+    }
+  }
+
+  if (!have_model) {
+    return SatResult::kUnknown;
+  }
+  for (uint8_t color : solution->colors_) {
+    if (color == SearchState<NumberType>::kUnassigned) {
+      fmt::print(std::cerr, "Solver model does not color every state\n");
+      return SatResult::kUnknown;
+    }
+  }
+  return SatResult::kSatisfiable;
+}
+
+// Write the encoding to cnf_path, run "command cnf_path" and read the model
+// the solver prints to stdout (as kissat, cadical and most competition
+// solvers do)
+template <typename NumberType>
+SatResult SolveWithSatSolver(const std::string& command,
+                             const std::string& cnf_path, NumberType ndim,
+                             bool symmetry_breaking,
+                             ColoringSolution<NumberType>* solution) {
+  {
+    std::ofstream out(cnf_path);
+    if (!WriteDimacs(out, ndim, symmetry_breaking)) {
+      fmt::print(std::cerr, "Failed to write {}\n", cnf_path);
+      return SatResult::kUnknown;
+    }
+  }
+
+  std::string command_line = command + " " + cnf_path;
+  FILE* pipe = popen(command_line.c_str(), "r");
+  if (!pipe) {
+    fmt::print(std::cerr, "Failed to run {}\n", command_line);
+    return SatResult::kUnknown;
+  }
+  std::stringstream output;
+  char buffer[1 << 12];
+  size_t n_read;
+  while ((n_read = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+    output.write(buffer, n_read);
+  }
+  pclose(pipe);
+
+  return ReadDimacsModel(output, ndim, solution);
+}
+
+// Coloring stored as one bit plane per color: bit state of plane c is set
+// if state has color c. Flipping one of the low six bits of a state is a
+// fixed permutation of the bits within a 64-bit word, and flipping a higher
+// bit selects a different word, so the closed neighborhoods of 64 states are
+// covered with a few word-wide ORs and no gathers.
+template <typename NumberType>
+struct BitPlaneColoring {
+  template <class ColorAssignment>
+  BitPlaneColoring(const ColorAssignment& coloring, NumberType ndim)
+      : ndim_(ndim),
+        n_colors_(GetNumberOfColors<NumberType>(ndim)),
+        n_states_(GetNumberOfStates<NumberType>(ndim)),
+        n_words_((GetNumberOfStates<NumberType>(ndim) + 63) / 64) {
+    planes_.assign(n_colors_ * n_words_, 0);
+    for (NumberType state = 0; state < n_states_; ++state) {
+      NumberType color = coloring[state];
+      assert(color < n_colors_);
+      planes_[color * n_words_ + state / 64] |= UINT64_C(0x01) << (state % 64);
+    }
+  }
+
+  // swap every bit with the bit whose index differs in position i < 6
+  static uint64_t FlipLowDimension(uint64_t word, unsigned i) {
+    static const uint64_t kMasks[6] = {
+        UINT64_C(0x5555555555555555), UINT64_C(0x3333333333333333),
+        UINT64_C(0x0F0F0F0F0F0F0F0F), UINT64_C(0x00FF00FF00FF00FF),
+        UINT64_C(0x0000FFFF0000FFFF), UINT64_C(0x00000000FFFFFFFF)};
+    unsigned shift = 1u << i;
+    return ((word >> shift) & kMasks[i]) | ((word & kMasks[i]) << shift);
+  }
+
+  // return the mask of states in word whose closed neighborhood contains
+  // every color
+  uint64_t GetCoveredStates(uint64_t word) const {
+    unsigned n_low = ndim_ < 6 ? static_cast<unsigned>(ndim_) : 6;
+    uint64_t covered = ~UINT64_C(0);
+    for (NumberType color = 0; color < n_colors_; ++color) {
+      const uint64_t* plane = &planes_[color * n_words_];
+      uint64_t seen = plane[word];
+      for (unsigned i = 0; i < n_low; ++i) {
+        seen |= FlipLowDimension(plane[word], i);
+      }
+      for (NumberType i = 6; i < ndim_; ++i) {
+        seen |= plane[word ^ (UINT64_C(0x01) << (i - 6))];
+      }
+      covered &= seen;
+    }
+    return covered;
+  }
+
+  // mask of the states that exist in a word, not all 64 if ndim < 6
+  uint64_t GetWordMask() const {
+    return n_states_ < 64 ? (UINT64_C(0x01) << n_states_) - 1 : ~UINT64_C(0);
+  }
+
+  NumberType operator[](NumberType state) const {
+    for (NumberType color = 0; color < n_colors_; ++color) {
+      if ((planes_[color * n_words_ + state / 64] >> (state % 64)) & 0x01) {
+        return color;
+      }
+    }
+    assert(false);
+    return 0;
+  }
+
+  NumberType ndim_;
+  NumberType n_colors_;
+  NumberType n_states_;
+  uint64_t n_words_;
+  // plane c occupies words [c * n_words_, (c + 1) * n_words_)
+  std::vector<uint64_t> planes_;
+};
+
+// Validate 64 states at a time on the bit planes
+template <typename NumberType>
+bool ValidateColoring(const BitPlaneColoring<NumberType>& coloring,
+                      NumberType ndim) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  assert(ndim == coloring.ndim_);
+  NumberType n_states = coloring.n_states_;
+  uint64_t word_mask = coloring.GetWordMask();
+  for (uint64_t word = 0; word < coloring.n_words_; ++word) {
+    uint64_t failed = ~coloring.GetCoveredStates(word) & word_mask;
+    if (failed) {
+      // the whole word was checked, not just the states up to the failure
+      uint64_t n_visited = std::min<uint64_t>((word + 1) * 64, n_states);
+      DEVILS_CHECKERBOARD_COUNT(states_visited, n_visited);
+      DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, n_visited * (ndim + 1));
+      NumberType failed_state = word * 64 + CountTrailingZeros(failed);
+      ReportViolation(ndim, failed_state,
+                      GetColorsSeen(coloring, ndim, failed_state));
+      return false;
+    }
+  }
+  DEVILS_CHECKERBOARD_COUNT(states_visited, n_states);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, uint64_t(n_states) * (ndim + 1));
+  return true;
+}
+
+struct BatchValidationResult {
+  bool is_valid;
+  uint64_t n_violations;
+  // lowest violating state, 2^ndim if there is none
+  uint64_t first_failure;
+};
+
+// Colors of several candidate colorings of one cube, interleaved by state:
+// the color of state s in candidate k is colors_[s * stride_ + k], so the
+// colors of every candidate at one neighbor are a single contiguous run. The
+// stride is padded to whole groups of kLanes candidates for the vector
+// kernel; padding colors are zero and never reported.
+template <typename NumberType>
+struct ColoringBatch {
+  static const size_t kLanes = 8;
+
+  template <class ColorAssignment>
+  ColoringBatch(const std::vector<ColorAssignment>& candidates,
+                NumberType ndim)
+      : ndim_(ndim),
+        n_candidates_(candidates.size()),
+        stride_((candidates.size() + kLanes - 1) / kLanes * kLanes),
+        colors_(GetNumberOfStates<NumberType>(ndim) * stride_) {
+    assert(GetNumberOfColors<NumberType>(ndim) <= 64);
+    NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+    for (NumberType state = 0; state < n_states; ++state) {
+      uint8_t* colors = &colors_[state * stride_];
+      for (size_t k = 0; k < n_candidates_; ++k) {
+        colors[k] = static_cast<uint8_t>(candidates[k][state]);
+      }
+    }
+  }
+
+  // the colors of state in every candidate
+  const uint8_t* operator[](NumberType state) const {
+    return &colors_[state * stride_];
+  }
+
+  NumberType ndim_;
+  size_t n_candidates_;
+  size_t stride_;
+  std::vector<uint8_t> colors_;
+};
+
+inline void RecordBatchViolation(BatchValidationResult* result,
+                                 uint64_t state) {
+  if (result->is_valid) {
+    result->is_valid = false;
+    result->first_failure = state;
+  }
+  ++result->n_violations;
+}
+
+// Each neighbor index is computed once per state and used for the colors of
+// all candidates
+template <typename NumberType>
+void ValidateColoringBatchScalar(const ColoringBatch<NumberType>& batch,
+                                 std::vector<BatchValidationResult>* results) {
+  NumberType ndim = batch.ndim_;
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  uint64_t n_colors = GetNumberOfColors<uint64_t>(ndim);
+  size_t n_candidates = batch.n_candidates_;
+
+  std::vector<uint64_t> colors_seen(n_candidates);
+  for (NumberType current_state = 0; current_state < n_states;
+       ++current_state) {
+    const uint8_t* colors = batch[current_state];
+    for (size_t k = 0; k < n_candidates; ++k) {
+      colors_seen[k] = UINT64_C(0x01) << colors[k];
+    }
+    for (NumberType i = 0; i < ndim; ++i) {
+      const uint8_t* neighbor_colors =
+          batch[current_state ^ (NumberType(0x01) << i)];
+      for (size_t k = 0; k < n_candidates; ++k) {
+        colors_seen[k] |= UINT64_C(0x01) << neighbor_colors[k];
+      }
+    }
+
+    for (size_t k = 0; k < n_candidates; ++k) {
+      if (PopCount(colors_seen[k]) != n_colors) {
+        RecordBatchViolation(&(*results)[k], current_state);
+      }
+    }
+  }
+}
+
+#ifdef DEVILS_CHECKERBOARD_X86_SIMD
+// 8 candidates per iteration, with one 32-bit mask per candidate, so the
+// colors must fit in 32 bits
+template <typename NumberType>
+__attribute__((target("avx2"))) void ValidateColoringBatchAVX2(
+    const ColoringBatch<NumberType>& batch,
+    std::vector<BatchValidationResult>* results) {
+  static_assert(ColoringBatch<NumberType>::kLanes == 8,
+                "one lane group per 256-bit vector of 32-bit masks");
+  NumberType ndim = batch.ndim_;
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = GetNumberOfColors<NumberType>(ndim);
+  assert(n_colors <= 32);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i n_colors_vector = _mm256_set1_epi32(n_colors);
+
+  for (NumberType current_state = 0; current_state < n_states;
+       ++current_state) {
+    for (size_t lane = 0; lane < batch.n_candidates_; lane += 8) {
+      __m256i colors = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+          reinterpret_cast<const __m128i*>(batch[current_state] + lane)));
+      __m256i colors_seen = _mm256_sllv_epi32(one, colors);
+      for (NumberType i = 0; i < ndim; ++i) {
+        colors = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(
+                batch[current_state ^ (NumberType(0x01) << i)] + lane)));
+        colors_seen =
+            _mm256_or_si256(colors_seen, _mm256_sllv_epi32(one, colors));
+      }
+
+      __m256i ok =
+          _mm256_cmpeq_epi32(PopCountAVX2(colors_seen), n_colors_vector);
+      uint32_t failed = ~_mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0xFF;
+      // padding lanes past the last candidate see only color 0
+      size_t n_lanes = std::min<size_t>(8, batch.n_candidates_ - lane);
+      failed &= (1u << n_lanes) - 1;
+      while (failed) {
+        unsigned k = __builtin_ctz(failed);
+        RecordBatchViolation(&(*results)[lane + k], current_state);
+        failed &= failed - 1;
+      }
+    }
+  }
+}
+#endif
+
+// Validate every candidate of a batch in one pass over the cube, with the
+// AVX2 kernel if the backend asks for it, the cpu supports it and the colors
+// fit in 32-bit masks. Every candidate is checked in full, so violation counts
+// are exact.
+template <typename NumberType>
+std::vector<BatchValidationResult> ValidateColoringBatch(
+    const ColoringBatch<NumberType>& batch, SimdBackend backend) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  NumberType n_states = GetNumberOfStates<NumberType>(batch.ndim_);
+  std::vector<BatchValidationResult> results(
+      batch.n_candidates_, BatchValidationResult{true, 0, n_states});
+  // every candidate visits every state, neighbor indices are shared
+  uint64_t n_visited = uint64_t(n_states) * batch.n_candidates_;
+  DEVILS_CHECKERBOARD_COUNT(states_visited, n_visited);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, n_visited * (batch.ndim_ + 1));
+#ifdef DEVILS_CHECKERBOARD_X86_SIMD
+  // a caller may request a backend the cpu lacks, so never trust it alone
+  static const SimdBackend kSupported = GetBestSimdBackend();
+  if ((backend == SimdBackend::kAVX2 || backend == SimdBackend::kAVX512) &&
+      kSupported != SimdBackend::kScalar &&
+      GetNumberOfColors<NumberType>(batch.ndim_) <= 32) {
+    ValidateColoringBatchAVX2(batch, &results);
+    return results;
+  }
+#endif
+  ValidateColoringBatchScalar(batch, &results);
+  return results;
+}
+
+template <typename NumberType>
+std::vector<BatchValidationResult> ValidateColoringBatch(
+    const ColoringBatch<NumberType>& batch) {
+  static const SimdBackend kBackend = GetBestSimdBackend();
+  return ValidateColoringBatch(batch, kBackend);
+}
+
+// Same as above for candidates that are not batched yet
+template <typename NumberType, class ColorAssignment>
+std::vector<BatchValidationResult> ValidateColoringBatch(
+    const std::vector<ColorAssignment>& candidates, NumberType ndim) {
+  return ValidateColoringBatch(ColoringBatch<NumberType>(candidates, ndim));
+}
+
+// Default sub-cube size of the blocked traversal: 2^14 states, small enough
+// that the block's colors and masks stay in L2
+static const unsigned kDefaultBlockDimensions = 14;
+
+// Walk the cube in sub-cubes of the low block_dims dimensions and call
+// visit(state, colors_seen) for every violating state in increasing order,
+// stopping early if visit returns false. Neighbors across the low dimensions
+// are looked up in a local copy of the block's colors. Neighbors across a
+// high dimension i all lie in the block at offset 2^i, so they are read as
+// one sequential sweep over that block instead of jumping by 2^i per state.
+template <typename NumberType, class ColorAssignment, class Visitor>
+void ForEachViolationBlocked(const ColorAssignment& coloring, NumberType ndim,
+                             NumberType block_dims, Visitor visit) {
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = GetNumberOfColors<NumberType>(ndim);
+  block_dims = std::min(block_dims, ndim);
+  NumberType block_states = GetNumberOfStates<NumberType>(block_dims);
+
+  std::vector<NumberType> block_colors(block_states);
+  std::vector<NumberType> colors_seen(block_states);
+  for (NumberType block = 0; block < n_states; block += block_states) {
+    for (NumberType j = 0; j < block_states; ++j) {
+      block_colors[j] = coloring[block + j];
+      colors_seen[j] = NumberType(0x01) << block_colors[j];
+    }
+    for (NumberType i = 0; i < block_dims; ++i) {
+      NumberType mask = NumberType(0x01) << i;
+      for (NumberType j = 0; j < block_states; ++j) {
+        colors_seen[j] |= NumberType(0x01) << block_colors[j ^ mask];
+      }
+    }
+    for (NumberType i = block_dims; i < ndim; ++i) {
+      NumberType neighbor_block = block ^ (NumberType(0x01) << i);
+      for (NumberType j = 0; j < block_states; ++j) {
+        colors_seen[j] |= NumberType(0x01) << coloring[neighbor_block + j];
+      }
+    }
+
+    for (NumberType j = 0; j < block_states; ++j) {
+      if (PopCount(colors_seen[j]) != n_colors &&
+          !visit(block + j, colors_seen[j])) {
+        return;
+      }
+    }
+  }
+}
+
+// Same as ValidateColoring, using the cache-blocked traversal
+template <typename NumberType, class ColorAssignment>
+bool ValidateColoringBlocked(const ColorAssignment& coloring, NumberType ndim,
+                             NumberType block_dims = kDefaultBlockDimensions) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType block_states =
+      GetNumberOfStates<NumberType>(std::min(block_dims, ndim));
+  // the traversal stops after the block holding the first failure
+  NumberType n_visited = n_states;
+  bool is_valid = true;
+  ForEachViolationBlocked(coloring, ndim, block_dims,
+                          [&](NumberType state, NumberType colors_seen) {
+                            ReportViolation(ndim, state, colors_seen);
+                            is_valid = false;
+                            n_visited =
+                                (state / block_states + 1) * block_states;
+                            return false;
+                          });
+  DEVILS_CHECKERBOARD_COUNT(states_visited, n_visited);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups,
+                            uint64_t(n_visited) * (ndim + 1));
+  return is_valid;
+}
+
+// Walk the cube in Gray-code order and call visit(state) for every
+// violating state in that order, stopping early if visit returns false.
+// Consecutive states differ in one bit j, so their closed neighborhoods share
+// the two states themselves: the color counts of the neighborhood slide by
+// dropping the ndim - 1 neighbors that are left behind and adding the
+// ndim - 1 new ones, and the two shared colors are never looked up again.
+template <typename NumberType, class ColorAssignment, class Visitor>
+void ForEachViolationGray(const ColorAssignment& coloring, NumberType ndim,
+                          Visitor visit) {
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = GetNumberOfColors<NumberType>(ndim);
+
+  // occurrences of each color in the current neighborhood
+  std::vector<NumberType> counts(n_colors, 0);
+  NumberType n_distinct = 0;
+  auto add = [&](NumberType color) {
+    assert(color < n_colors);
+    n_distinct += counts[color]++ == 0;
+  };
+  auto remove = [&](NumberType color) {
+    n_distinct -= --counts[color] == 0;
+  };
+
+  NumberType current_state = 0;
+  NumberType self_color = coloring[current_state];
+  add(self_color);
+  // neighbor_colors[i] is the color of current_state ^ 2^i
+  std::vector<NumberType> neighbor_colors(ndim);
+  for (NumberType i = 0; i < ndim; ++i) {
+    neighbor_colors[i] = coloring[NumberType(0x01) << i];
+    add(neighbor_colors[i]);
+  }
+
+  for (NumberType step = 1;; ++step) {
+    if (n_distinct != n_colors && !visit(current_state)) {
+      return;
+    }
+    if (step == n_states) {
+      return;
+    }
+
+    NumberType j = CountTrailingZeros(step);
+    NumberType next_state = current_state ^ (NumberType(0x01) << j);
+    for (NumberType i = 0; i < ndim; ++i) {
+      if (i != j) {
+        remove(neighbor_colors[i]);
+        neighbor_colors[i] = coloring[next_state ^ (NumberType(0x01) << i)];
+        add(neighbor_colors[i]);
+      }
+    }
+    std::swap(self_color, neighbor_colors[j]);
+    current_state = next_state;
+  }
+}
+
+// Same as ValidateColoring, using the Gray-code traversal. The failure
+// reported is the first one in Gray-code order.
+template <typename NumberType, class ColorAssignment>
+bool ValidateColoringGray(const ColorAssignment& coloring, NumberType ndim) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_visited = n_states;
+  bool is_valid = true;
+  ForEachViolationGray(coloring, ndim, [&](NumberType state) {
+    ReportViolation(ndim, state, GetColorsSeen(coloring, ndim, state));
+    is_valid = false;
+    // the failure is visited at its Gray-code rank
+    NumberType rank = state;
+    for (NumberType shift = 1; shift < ndim; shift <<= 1) {
+      rank ^= rank >> shift;
+    }
+    n_visited = rank + 1;
+    return false;
+  });
+  // the first state sees its whole neighborhood, every later one only the
+  // ndim - 1 neighbors it does not share with its predecessor
+  DEVILS_CHECKERBOARD_COUNT(states_visited, n_visited);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups,
+                            (ndim + 1) + uint64_t(n_visited - 1) * (ndim - 1));
+  return is_valid;
+}
+
+// write all of data to fd, return false on error
+inline bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n_written = write(fd, data, size);
+    if (n_written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n_written;
+    size -= n_written;
+  }
+  return true;
+}
+
+// Failing states of one thread, kept in storage allocated up front. Once
+// capacity states are buffered they are formatted in one block and written
+// to fd with a single write(2) while holding fd_mutex, so blocks of different
+// threads never interleave. With fd < 0 the states are only counted. After a
+// failed write the remaining states are counted but no longer written.
+template <typename NumberType>
+struct ViolationBuffer {
+  ViolationBuffer(NumberType ndim, size_t capacity, int fd,
+                  std::mutex* fd_mutex)
+      : ndim_(ndim),
+        capacity_(capacity),
+        fd_(fd),
+        fd_mutex_(fd_mutex),
+        n_violations_(0),
+        is_write_failed_(false) {
+    assert(capacity > 0);
+    entries_.reserve(capacity);
+  }
+
+  ~ViolationBuffer() {
+    Flush();
+  }
+
+  void Add(NumberType state, NumberType colors_seen) {
+    ++n_violations_;
+    if (fd_ < 0 || is_write_failed_) {
+      return;
+    }
+    entries_.emplace_back(state, colors_seen);
+    if (entries_.size() == capacity_) {
+      Flush();
+    }
+  }
+
+  // return false if any buffered state could not be written
+  bool Flush() {
+    if (entries_.empty()) {
+      return !is_write_failed_;
+    }
+    // the writer keeps its storage across flushes
+    writer_.clear();
+    for (const std::pair<NumberType, NumberType>& entry : entries_) {
+      FormatViolation(&writer_, ndim_, entry.first, entry.second);
+    }
+    entries_.clear();
+    std::lock_guard<std::mutex> lock(*fd_mutex_);
+    if (!WriteAll(fd_, writer_.data(), writer_.size())) {
+      is_write_failed_ = true;
+    }
+    return !is_write_failed_;
+  }
+
+  NumberType ndim_;
+  size_t capacity_;
+  int fd_;
+  std::mutex* fd_mutex_;
+  NumberType n_violations_;
+  bool is_write_failed_;
+  std::vector<std::pair<NumberType, NumberType>> entries_;
+  fmt::MemoryWriter writer_;
+};
+
+static const size_t kDefaultViolationBufferSize = 4096;
+
+// Check every state instead of stopping at the first failure, and write the
+// diagnostics of all violating states to fd (std::cout must be flushed first
+// if both refer to the same file). The states are split into num_threads
+// contiguous ranges, each with its own ViolationBuffer; within a block the
+// states are in increasing order. Return the number of violating states, and
+// set is_written to false if some of the diagnostics could not be written.
+template <typename NumberType, class ColorAssignment>
+NumberType CollectViolations(const ColorAssignment& coloring, NumberType ndim,
+                             unsigned num_threads, int fd,
+                             bool* is_written = nullptr,
+                             size_t capacity = kDefaultViolationBufferSize) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = ndim;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (n_states < num_threads) {
+    num_threads = static_cast<unsigned>(n_states);
+  }
+
+  std::mutex fd_mutex;
+  std::atomic<NumberType> n_violations(0);
+  std::atomic<bool> is_write_failed(false);
+  auto worker = [&](NumberType begin, NumberType end) {
+    ViolationBuffer<NumberType> buffer(ndim, capacity, fd, &fd_mutex);
+    for (NumberType current_state = begin; current_state < end;
+         ++current_state) {
+      NumberType colors_seen = GetColorsSeen(coloring, ndim, current_state);
+      if (PopCount(colors_seen) != n_colors) {
+        buffer.Add(current_state, colors_seen);
+      }
+    }
+    if (!buffer.Flush()) {
+      is_write_failed.store(true);
+    }
+    n_violations += buffer.n_violations_;
+    DEVILS_CHECKERBOARD_COUNT(states_visited, end - begin);
+    DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, (end - begin) * (ndim + 1));
+  };
+
+  if (num_threads == 1) {
+    worker(0, n_states);
+  } else {
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    NumberType states_per_thread = n_states / num_threads;
+    NumberType remainder = n_states % num_threads;
+    NumberType begin = 0;
+    for (unsigned i = 0; i < num_threads; ++i) {
+      NumberType end = begin + states_per_thread + (i < remainder ? 1 : 0);
+      threads.emplace_back(worker, begin, end);
+      begin = end;
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  if (is_written) {
+    *is_written = !is_write_failed.load();
+  }
+  return n_violations.load();
+}
+
+// Same coloring as GenerateColoring, built by num_threads threads. The state
+// at position t of the topological order gets color t % n_colors, so the
+// order is split into contiguous ranges of positions. Each thread finds the
+// first state of its range by unranking its position within the layer, and
+// then enumerates like ForEachStateInLayer, crossing into the next layers.
+template <typename NumberType>
+std::vector<NumberType> ParallelGenerateColoring(NumberType ndim,
+                                                 unsigned num_threads) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseGenerate);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = GetNumberOfColors<NumberType>(ndim);
+  NumberType all_states = n_states - 1;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (n_states < num_threads) {
+    num_threads = static_cast<unsigned>(n_states);
+  }
+
+  std::vector<NumberType> result(n_states);
+  auto worker = [&](NumberType begin, NumberType end) {
+    // layer of position begin and the position its first state has
+    NumberType layer = 0;
+    NumberType layer_begin = 0;
+    while (layer_begin + Binomial(ndim, layer) <= begin) {
+      layer_begin += Binomial(ndim, layer);
+      ++layer;
+    }
+    NumberType layer_end = layer_begin + Binomial(ndim, layer);
+
+    // states of a layer are the complements of increasing numbers with
+    // ndim - layer bits set
+    NumberType complement =
+        UnrankColex<NumberType>(begin - layer_begin, ndim - layer);
+    NumberType color = begin % n_colors;
+    for (NumberType position = begin;;) {
+      result[all_states ^ complement] = color;
+      if (++position == end) {
+        break;
+      }
+
+      color = color + 1 == n_colors ? 0 : color + 1;
+      if (position == layer_end) {
+        ++layer;
+        layer_end += Binomial(ndim, layer);
+        complement = (NumberType(0x01) << (ndim - layer)) - 1;
+      } else {
+        complement = NextSamePopCount(complement);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  NumberType states_per_thread = n_states / num_threads;
+  NumberType remainder = n_states % num_threads;
+  NumberType begin = 0;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    NumberType end = begin + states_per_thread + (i < remainder ? 1 : 0);
+    threads.emplace_back(worker, begin, end);
+    begin = end;
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  DEVILS_CHECKERBOARD_COUNT(states_emitted, n_states);
+  DEVILS_CHECKERBOARD_COUNT(bytes_allocated, n_states * sizeof(NumberType));
+  return result;
+}
+
+struct ScreeningOptions {
+  ScreeningOptions() : num_samples(256), seed(0), is_stratified(false) {}
+
+  unsigned num_samples;
+  uint64_t seed;
+  // spread the samples evenly over the popcount layers instead of over the
+  // states, which puts many more of them in the small outer layers
+  bool is_stratified;
+};
+
+struct ScreeningResult {
+  bool is_valid;
+  // true if a sampled state failed and the exhaustive pass was skipped
+  bool is_rejected_by_sample;
+  // the first failing state found, n_states if none
+  uint64_t failed_state;
+  // closed neighborhoods checked, samples included
+  uint64_t n_checked;
+  // fraction of the exhaustive pass that did not have to be done
+  double skipped_fraction;
+};
+
+// Check a seeded random sample of states and fall through to the exhaustive
+// check only if all of them pass. Invalid colorings usually fail somewhere
+// in the sample, which costs O(num_samples) instead of O(2^ndim).
+template <typename NumberType, class ColorAssignment>
+ScreeningResult ScreenColoring(const ColorAssignment& coloring,
+                               NumberType ndim,
+                               const ScreeningOptions& options) {
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = GetNumberOfColors<NumberType>(ndim);
+  NumberType all_states = n_states - 1;
+  ScreeningResult result;
+  result.is_valid = true;
+  result.is_rejected_by_sample = false;
+  result.failed_state = n_states;
+  result.n_checked = 0;
+  auto check_state = [&](NumberType state) {
+    ++result.n_checked;
+    if (PopCount(GetColorsSeen(coloring, ndim, state)) != n_colors) {
+      result.is_valid = false;
+      result.failed_state = state;
+    }
+    return result.is_valid;
+  };
+
+  std::mt19937_64 generator(options.seed);
+  for (unsigned i = 0; i < options.num_samples && result.is_valid; ++i) {
+    if (options.is_stratified) {
+      // states of a layer are complements of numbers with ndim - layer bits
+      NumberType layer = i % (ndim + 1);
+      std::uniform_int_distribution<uint64_t> rank(
+          0, Binomial(ndim, layer) - 1);
+      check_state(all_states ^ UnrankColex<NumberType>(rank(generator),
+                                                       ndim - layer));
+    } else {
+      std::uniform_int_distribution<uint64_t> state(0, all_states);
+      check_state(static_cast<NumberType>(state(generator)));
+    }
+  }
+  result.is_rejected_by_sample = !result.is_valid;
+
+  for (NumberType state = 0; state < n_states && result.is_valid; ++state) {
+    check_state(state);
+  }
+
+  result.skipped_fraction =
+      result.n_checked < n_states
+          ? 1.0 - static_cast<double>(result.n_checked) / n_states
+          : 0.0;
+  DEVILS_CHECKERBOARD_COUNT(states_visited, result.n_checked);
+  DEVILS_CHECKERBOARD_COUNT(neighbor_lookups, result.n_checked * (ndim + 1));
+  return result;
+}
+
+// Same as ValidateColoring, screening a random sample of states first
+template <typename NumberType, class ColorAssignment>
+bool ValidateColoring(const ColorAssignment& coloring, NumberType ndim,
+                      const ScreeningOptions& options,
+                      ScreeningResult* result = nullptr) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  ScreeningResult screening = ScreenColoring(coloring, ndim, options);
+  if (!screening.is_valid) {
+    NumberType failed_state = static_cast<NumberType>(screening.failed_state);
+    ReportViolation(ndim, failed_state,
+                    GetColorsSeen(coloring, ndim, failed_state));
+  }
+  if (result) {
+    *result = screening;
+  }
+  return screening.is_valid;
+}
+
+// Family of cycle assignments generalizing MirrorAssignment: the color of a
+// state is permutation[shape((state ^ xor_mask) + offset) % cycle_length],
+// where the shape either counts the colors up cyclically or goes up and back
+// down like the mirror zig-zag.
+enum class CycleShape : uint8_t { kCyclic, kMirror };
+
+static const unsigned kMaxCycleColors = 64;
+static const uint32_t kMaxCycleLength = 1024;
+
+// parameters of one CycleAssignment, compact so that sweeps can hold many
+struct CycleParams {
+  uint32_t cycle_length;
+  uint32_t offset;
+  uint64_t xor_mask;
+  CycleShape shape;
+  // permutation of the colors, entries past the number of colors are unused
+  uint8_t permutation[kMaxCycleColors];
+};
+
+// the parameters for which CycleAssignment is MirrorAssignment
+inline CycleParams GetMirrorCycleParams(unsigned ndim) {
+  assert(ndim > 0 && ndim <= kMaxCycleColors);
+  CycleParams params;
+  params.cycle_length = 2 * ndim;
+  params.offset = 0;
+  params.xor_mask = 0;
+  params.shape = CycleShape::kMirror;
+  for (unsigned i = 0; i < kMaxCycleColors; ++i) {
+    params.permutation[i] = static_cast<uint8_t>(i);
+  }
+  return params;
+}
+
+// random parameters for a sweep over the family
+template <class Generator>
+CycleParams GetRandomCycleParams(unsigned ndim, Generator& generator) {
+  CycleParams params = GetMirrorCycleParams(ndim);
+  uint32_t max_length = std::min<uint32_t>(4 * ndim, kMaxCycleLength);
+  params.cycle_length = std::uniform_int_distribution<uint32_t>(
+      ndim, max_length)(generator);
+  params.offset = std::uniform_int_distribution<uint32_t>(
+      0, params.cycle_length - 1)(generator);
+  params.xor_mask = std::uniform_int_distribution<uint64_t>(
+      0, (UINT64_C(0x01) << ndim) - 1)(generator);
+  params.shape = generator() & 0x01 ? CycleShape::kMirror : CycleShape::kCyclic;
+  std::shuffle(params.permutation, params.permutation + ndim, generator);
+  return params;
+}
+
+// Random-access CycleAssignment. The cycle is precomputed into a table;
+// kPowerOfTwo cycles are indexed with a mask, others with FastMod64.
+template <typename NumberType, bool kPowerOfTwo>
+struct CycleAssignment {
+  CycleAssignment(const CycleParams& params, NumberType ndim)
+      : ndim_(ndim),
+        cycle_length_(params.cycle_length),
+        offset_(params.offset),
+        xor_mask_(params.xor_mask),
+        multiplier_(UINT64_C(0xFFFFFFFFFFFFFFFF) / params.cycle_length + 1),
+        high_word_offset_(static_cast<uint32_t>((UINT64_C(1) << 32) %
+                                                params.cycle_length)),
+        table_(params.cycle_length) {
+    NumberType n_colors = GetNumberOfColors<NumberType>(ndim);
+    assert(n_colors <= kMaxCycleColors);
+    assert(cycle_length_ > 0 && cycle_length_ <= kMaxCycleLength);
+    assert(!kPowerOfTwo || (cycle_length_ & (cycle_length_ - 1)) == 0);
+    assert(xor_mask_ < GetNumberOfStates<NumberType>(ndim));
+    uint32_t half = (cycle_length_ + 1) / 2;
+    for (uint32_t i = 0; i < cycle_length_; ++i) {
+      uint32_t position = i;
+      if (params.shape == CycleShape::kMirror && i >= half) {
+        position = cycle_length_ - 1 - i;
+      }
+      table_[i] = params.permutation[position % n_colors];
+      assert(table_[i] < n_colors);
+    }
+  }
+
+  NumberType operator[](NumberType state) const {
+    assert(state < GetNumberOfStates<NumberType>(ndim_));
+    uint64_t value = static_cast<uint64_t>(state ^ xor_mask_) + offset_;
+    if (kPowerOfTwo) {
+      return table_[value & (cycle_length_ - 1)];
+    }
+    return table_[FastMod64(value, multiplier_, cycle_length_,
+                            high_word_offset_)];
+  }
+
+  NumberType ndim_;
+  uint32_t cycle_length_;
+  uint32_t offset_;
+  NumberType xor_mask_;
+  uint64_t multiplier_;
+  uint32_t high_word_offset_;
+  std::vector<uint8_t> table_;
+};
+
+template <typename NumberType, bool kPowerOfTwo>
+ScreeningResult ScreenCycleCandidate(const CycleParams& params,
+                                     NumberType ndim,
+                                     const ScreeningOptions& options) {
+  CycleAssignment<NumberType, kPowerOfTwo> coloring(params, ndim);
+  return ScreenColoring(coloring, ndim, options);
+}
+
+struct CycleSweepResult {
+  CycleSweepResult()
+      : n_rejected_by_sample(0), n_rejected_by_full_pass(0), n_checked(0) {}
+
+  // indices of the valid candidates
+  std::vector<size_t> valid;
+  uint64_t n_rejected_by_sample;
+  uint64_t n_rejected_by_full_pass;
+  // number of closed neighborhoods checked over all candidates
+  uint64_t n_checked;
+};
+
+// Screen every candidate with ScreenColoring, candidate i with the sample
+// seeded by screening.seed + i. The kernel for each candidate is taken from
+// a table of instantiations indexed by whether its cycle length is a power
+// of two, so the lookups of one candidate never branch on its parameters.
+template <typename NumberType>
+CycleSweepResult SweepCycleAssignments(
+    const std::vector<CycleParams>& candidates, NumberType ndim,
+    const ScreeningOptions& screening) {
+  typedef ScreeningResult (*ScreenFunction)(const CycleParams&, NumberType,
+                                            const ScreeningOptions&);
+  static const ScreenFunction kScreenFunctions[2] = {
+      &ScreenCycleCandidate<NumberType, false>,
+      &ScreenCycleCandidate<NumberType, true>};
+
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  CycleSweepResult result;
+  ScreeningOptions options = screening;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const CycleParams& params = candidates[i];
+    bool is_power_of_two =
+        (params.cycle_length & (params.cycle_length - 1)) == 0;
+    options.seed = screening.seed + i;
+    ScreeningResult candidate =
+        kScreenFunctions[is_power_of_two](params, ndim, options);
+    if (candidate.is_valid) {
+      result.valid.push_back(i);
+    } else if (candidate.is_rejected_by_sample) {
+      ++result.n_rejected_by_sample;
+    } else {
+      ++result.n_rejected_by_full_pass;
+    }
+    result.n_checked += candidate.n_checked;
+  }
+  return result;
+}
+
+// Checkpoints of long validation, generation and search runs. A checkpoint
+// file is a CheckpointHeader followed by num_words 64-bit words, in the same
+// native layout as the coloring files. It is written to a temporary file
+// which is then renamed over the old checkpoint, so a crash leaves either the
+// old or the new one. The runs remove their checkpoint once they finish.
+enum class CheckpointKind : uint32_t { kValidate = 1, kGenerate, kSearch };
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t kind;
+  uint32_t ndim;
+  uint32_t reserved;
+  // identifies what the run works on, e.g. the coloring being validated, so
+  // that a checkpoint of another run is never resumed
+  uint64_t fingerprint;
+  // position of the run, the meaning depends on the kind
+  uint64_t values[4];
+  uint64_t num_words;
+};
+
+static const char kCheckpointFileMagic[8] = {'D', 'C', 'C', 'H',
+                                             'K', 'P', 'T', '\0'};
+static const uint32_t kCheckpointFileVersion = 2;
+
+// FNV-1a over 64-bit values, for checkpoint fingerprints
+static const uint64_t kFingerprintSeed = UINT64_C(0xCBF29CE484222325);
+
+inline uint64_t MixFingerprint(uint64_t fingerprint, uint64_t value) {
+  return (fingerprint ^ value) * UINT64_C(0x100000001B3);
+}
+
+// fingerprint of the colors of every state, one lookup per state
+template <typename NumberType, class ColorAssignment>
+uint64_t GetColoringFingerprint(const ColorAssignment& coloring,
+                                NumberType ndim) {
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  uint64_t fingerprint = MixFingerprint(kFingerprintSeed, ndim);
+  for (NumberType state = 0; state < n_states; ++state) {
+    fingerprint = MixFingerprint(fingerprint, coloring[state]);
+  }
+  return fingerprint;
+}
+
+inline bool WriteCheckpoint(const std::string& path, CheckpointKind kind,
+                            unsigned ndim, uint64_t fingerprint,
+                            const uint64_t values[4],
+                            const std::vector<uint64_t>& words) {
+  CheckpointHeader header;
+  std::memcpy(header.magic, kCheckpointFileMagic, sizeof(header.magic));
+  header.version = kCheckpointFileVersion;
+  header.kind = static_cast<uint32_t>(kind);
+  header.ndim = ndim;
+  header.reserved = 0;
+  header.fingerprint = fingerprint;
+  std::copy(values, values + 4, header.values);
+  header.num_words = words.size();
+
+  std::string temp_path = path + ".tmp";
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fmt::print(std::cerr, "Failed to create checkpoint {}\n", temp_path);
+    return false;
+  }
+  bool is_ok =
+      WriteAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+      WriteAll(fd, reinterpret_cast<const char*>(words.data()),
+               words.size() * sizeof(uint64_t)) &&
+      fsync(fd) == 0;
+  is_ok &= close(fd) == 0;
+  if (!is_ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    fmt::print(std::cerr, "Failed to write checkpoint {}\n", path);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Read a checkpoint of kind for ndim and fingerprint. Return false if there
+// is none, which is also the case for a checkpoint of some other run.
+inline bool ReadCheckpoint(const std::string& path, CheckpointKind kind,
+                           unsigned ndim, uint64_t fingerprint,
+                           uint64_t values[4], std::vector<uint64_t>* words) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  CheckpointHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in ||
+      std::memcmp(header.magic, kCheckpointFileMagic,
+                  sizeof(header.magic)) != 0 ||
+      header.version != kCheckpointFileVersion ||
+      header.kind != static_cast<uint32_t>(kind) || header.ndim != ndim ||
+      header.fingerprint != fingerprint) {
+    fmt::print(std::cerr, "Ignoring checkpoint {} of another run\n", path);
+    return false;
+  }
+  words->resize(header.num_words);
+  in.read(reinterpret_cast<char*>(words->data()),
+          header.num_words * sizeof(uint64_t));
+  if (!in) {
+    fmt::print(std::cerr, "Checkpoint {} is truncated\n", path);
+    return false;
+  }
+  std::copy(header.values, header.values + 4, values);
+  return true;
+}
+
+// Same as ValidateColoring, but the index of the next state to check is
+// saved to checkpoint_path every interval states, and a run started with an
+// existing checkpoint continues from there. The checkpoint is only resumed
+// if it was written for the same fingerprint of the coloring.
+template <typename NumberType, class ColorAssignment>
+bool ValidateColoringCheckpointed(const ColorAssignment& coloring,
+                                  NumberType ndim,
+                                  const std::string& checkpoint_path,
+                                  uint64_t interval, uint64_t fingerprint) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+  assert(interval > 0);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  NumberType n_colors = ndim;
+  uint64_t values[4] = {0, 0, 0, 0};
+  std::vector<uint64_t> words;
+  if (ReadCheckpoint(checkpoint_path, CheckpointKind::kValidate, ndim,
+                     fingerprint, values, &words) &&
+      values[0] <= n_states) {
+    fmt::print(std::cerr, "Resuming validation at state {}\n", values[0]);
+  } else {
+    values[0] = 0;
+  }
+
+  NumberType current_state = values[0];
+  while (current_state < n_states) {
+    NumberType end = current_state + std::min<uint64_t>(
+                                         interval, n_states - current_state);
+    for (; current_state < end; ++current_state) {
+      NumberType colors_seen = GetColorsSeen(coloring, ndim, current_state);
+      if (PopCount(colors_seen) != n_colors) {
+        ReportViolation(ndim, current_state, colors_seen);
+        unlink(checkpoint_path.c_str());
+        return false;
+      }
+    }
+    values[0] = current_state;
+    if (current_state < n_states) {
+      WriteCheckpoint(checkpoint_path, CheckpointKind::kValidate, ndim,
+                      fingerprint, values, words);
+    }
+  }
+
+  unlink(checkpoint_path.c_str());
+  return true;
+}
+
+// Same, fingerprinting the colors of every state first
+template <typename NumberType, class ColorAssignment>
+bool ValidateColoringCheckpointed(const ColorAssignment& coloring,
+                                  NumberType ndim,
+                                  const std::string& checkpoint_path,
+                                  uint64_t interval) {
+  return ValidateColoringCheckpointed(coloring, ndim, checkpoint_path,
+                                      interval,
+                                      GetColoringFingerprint(coloring, ndim));
+}
+
+// Same as GenerateColoring into a packed buffer, checkpointing the position
+// of the topological enumeration and the colors assigned so far every
+// interval states. Each checkpoint writes the whole packed buffer, so the
+// interval should be a sizeable fraction of the states. The coloring only
+// depends on ndim, so the fingerprint only covers the packed layout.
+template <typename NumberType>
+void GenerateColoringCheckpointed(NumberType ndim,
+                                  PackedColoring<NumberType>* result,
+                                  const std::string& checkpoint_path,
+                                  uint64_t interval) {
+  DEVILS_CHECKERBOARD_PHASE(kPhaseGenerate);
+  assert(interval > 0);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  TopologicalColoringStream<NumberType> stream(ndim);
+  result->Reset(n_states, GetBitsPerColor(GetNumberOfColors<NumberType>(ndim)));
+
+  // values are the layer, complement and next color of the stream and the
+  // number of states colored
+  uint64_t values[4] = {0, 0, 0, 0};
+  std::vector<uint64_t> words;
+  uint64_t n_colored = 0;
+  uint64_t fingerprint = MixFingerprint(
+      MixFingerprint(kFingerprintSeed, result->bits_per_color_),
+      result->words_.size());
+  if (ReadCheckpoint(checkpoint_path, CheckpointKind::kGenerate, ndim,
+                     fingerprint, values, &words) &&
+      words.size() == result->words_.size() && values[0] <= ndim &&
+      values[3] <= n_states) {
+    fmt::print(std::cerr, "Resuming generation at state {} of {}\n",
+               values[3], n_states);
+    stream.layer_ = values[0];
+    stream.complement_ = values[1];
+    stream.next_color_ = values[2];
+    n_colored = values[3];
+    result->words_.swap(words);
+  }
+
+  NumberType state;
+  NumberType color;
+  while (stream.Next(&state, &color)) {
+    result->SetColor(state, color);
+    if (++n_colored % interval == 0 && n_colored < n_states) {
+      values[0] = stream.layer_;
+      values[1] = stream.complement_;
+      values[2] = stream.next_color_;
+      values[3] = n_colored;
+      WriteCheckpoint(checkpoint_path, CheckpointKind::kGenerate, ndim,
+                      fingerprint, values, result->words_);
+    }
+  }
+  DEVILS_CHECKERBOARD_COUNT(states_emitted, n_states);
+  unlink(checkpoint_path.c_str());
+}
+
+// fingerprint of the order and colors that positions written by
+// ExhaustiveSearch::Save() refer to
+template <typename NumberType>
+uint64_t GetSearchFingerprint(const ExhaustiveSearch<NumberType>& search) {
+  uint64_t fingerprint =
+      MixFingerprint(kFingerprintSeed, search.state_.n_colors_);
+  for (NumberType state : search.order_) {
+    fingerprint = MixFingerprint(fingerprint, state);
+  }
+  return fingerprint;
+}
+
+// Same as SearchColoring, checkpointing the search stack every interval
+// nodes
+template <typename NumberType>
+bool SearchColoringCheckpointed(NumberType ndim,
+                                ColoringSolution<NumberType>* solution,
+                                const std::string& checkpoint_path,
+                                uint64_t interval,
+                                uint64_t* n_nodes = nullptr) {
+  assert(interval > 0);
+  ExhaustiveSearch<NumberType> search(ndim);
+  uint64_t values[4];
+  std::vector<uint64_t> words;
+  bool is_resumed = false;
+  uint64_t fingerprint = GetSearchFingerprint(search);
+  if (ReadCheckpoint(checkpoint_path, CheckpointKind::kSearch, ndim,
+                     fingerprint, values, &words)) {
+    is_resumed = search.Restore(values, words);
+    if (is_resumed) {
+      fmt::print(std::cerr, "Resuming search at depth {} after {} nodes\n",
+                 search.depth_, search.n_nodes_);
+    }
+  }
+
+  bool found = false;
+  unsigned first_case = is_resumed ? search.symmetry_case_ : 0;
+  for (unsigned symmetry_case = first_case;
+       symmetry_case < kNumSymmetryCases && !found; ++symmetry_case) {
+    if (is_resumed || search.Start(symmetry_case)) {
+      is_resumed = false;
+      SearchStatus status = SearchStatus::kPaused;
+      while (status == SearchStatus::kPaused) {
+        status = search.Run(interval);
+        if (status == SearchStatus::kPaused) {
+          search.Save(values, &words);
+          WriteCheckpoint(checkpoint_path, CheckpointKind::kSearch, ndim,
+                          fingerprint, values, words);
+        }
+      }
+      found = status == SearchStatus::kFound;
+    }
+  }
+
+  if (found) {
+    solution->n_violations_ = 0;
+    solution->colors_ = search.state_.colors_;
+  }
+  if (n_nodes) {
+    *n_nodes = search.n_nodes_;
+  }
+  unlink(checkpoint_path.c_str());
+  return found;
+}
+
+// Blocking FIFO of at most capacity items for handing work between
+// pipeline stages. Push blocks while the queue is full and Pop while it is
+// empty. After Close, Pop drains the remaining items and then returns false.
+template <class T>
+struct BoundedQueue {
+  explicit BoundedQueue(size_t capacity)
+      : capacity_(capacity), is_closed_(false) {
+    assert(capacity > 0);
+  }
+
+  void Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+  }
+
+  bool Pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !items_.empty() || is_closed_; });
+    if (items_.empty()) {
+      return false;
+    }
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+    not_empty_.notify_all();
+  }
+
+  size_t capacity_;
+  bool is_closed_;
+  std::deque<T> items_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+// consecutive (state, color) pairs of the topological order
+template <typename NumberType>
+struct ColoringChunk {
+  std::vector<NumberType> states_;
+  std::vector<uint8_t> colors_;
+};
+
+static const size_t kDefaultPipelineChunkSize = 1 << 16;
+static const size_t kDefaultPipelineChunks = 4;
+
+// Same as StreamColoring, validating the coloring on the way. Generating,
+// validating and writing to sink run as three overlapped stages: the
+// generator fills chunks of chunk_size pairs, the validator feeds them to a
+// StreamingValidator, and the calling thread hands them to sink.Add(state,
+// color). Chunks move between the stages by pointer and come from a pool of
+// n_chunks, so a stage that falls behind stalls the generator and at most
+// n_chunks chunks exist besides the three-layer validator window. Return
+// true if the coloring is valid.
+template <typename NumberType, class Sink>
+bool PipelineColoring(NumberType ndim, Sink& sink,
+                      size_t chunk_size = kDefaultPipelineChunkSize,
+                      size_t n_chunks = kDefaultPipelineChunks) {
+  typedef std::unique_ptr<ColoringChunk<NumberType>> ChunkPointer;
+  assert(chunk_size > 0);
+
+  // every chunk is in at most one queue, so no Push ever blocks and all the
+  // back-pressure comes from waiting on free_chunks
+  BoundedQueue<ChunkPointer> free_chunks(n_chunks);
+  BoundedQueue<ChunkPointer> to_validate(n_chunks);
+  BoundedQueue<ChunkPointer> to_write(n_chunks);
+  for (size_t i = 0; i < n_chunks; ++i) {
+    ChunkPointer chunk(new ColoringChunk<NumberType>());
+    chunk->states_.reserve(chunk_size);
+    chunk->colors_.reserve(chunk_size);
+    free_chunks.Push(std::move(chunk));
+  }
+  DEVILS_CHECKERBOARD_COUNT(
+      bytes_allocated, n_chunks * chunk_size * (sizeof(NumberType) + 1));
+
+  std::thread generator([&] {
+    DEVILS_CHECKERBOARD_PHASE(kPhaseGenerate);
+    TopologicalColoringStream<NumberType> stream(ndim);
+    NumberType state, color;
+    bool is_done = false;
+    while (!is_done) {
+      ChunkPointer chunk;
+      free_chunks.Pop(&chunk);
+      chunk->states_.clear();
+      chunk->colors_.clear();
+      while (chunk->states_.size() < chunk_size) {
+        if (!stream.Next(&state, &color)) {
+          is_done = true;
+          break;
+        }
+        chunk->states_.push_back(state);
+        chunk->colors_.push_back(static_cast<uint8_t>(color));
+      }
+      DEVILS_CHECKERBOARD_COUNT(states_emitted, chunk->states_.size());
+      if (chunk->states_.empty()) {
+        free_chunks.Push(std::move(chunk));
+      } else {
+        to_validate.Push(std::move(chunk));
+      }
+    }
+    to_validate.Close();
+  });
+
+  bool is_valid = true;
+  std::thread validator([&] {
+    DEVILS_CHECKERBOARD_PHASE(kPhaseValidate);
+    StreamingValidator<NumberType> streaming(ndim);
+    ChunkPointer chunk;
+    while (to_validate.Pop(&chunk)) {
+      for (size_t i = 0; i < chunk->states_.size(); ++i) {
+        streaming.Add(chunk->states_[i], chunk->colors_[i]);
+      }
+      to_write.Push(std::move(chunk));
+    }
+    is_valid = streaming.Finish();
+    to_write.Close();
+  });
+
+  ChunkPointer chunk;
+  while (to_write.Pop(&chunk)) {
+    for (size_t i = 0; i < chunk->states_.size(); ++i) {
+      sink.Add(chunk->states_[i], NumberType(chunk->colors_[i]));
+    }
+    free_chunks.Push(std::move(chunk));
+  }
+  generator.join();
+  validator.join();
+  return is_valid;
+}
+
+#endif  // DEVILS_CHECKERBOARD_H_
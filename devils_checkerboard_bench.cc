@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "devils_checkerboard.h"
+
+// Microbenchmarks for the core kernels, parameterized over ndim (the
+// benchmark argument) and NumberType (the template argument). Each benchmark
+// reports states/sec as items_per_second and the memory footprint of the
+// coloring as bytes_per_state.
+
+// report per-state throughput and footprint for a pass over n_states states
+static void SetStateCounters(benchmark::State& state, uint64_t n_states,
+                             double bytes_per_state) {
+  state.SetItemsProcessed(state.iterations() * n_states);
+  state.counters["bytes_per_state"] = bytes_per_state;
+}
+
+template <typename NumberType>
+static void BM_PopCount(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  for (auto _ : state) {
+    NumberType sum = 0;
+    for (NumberType i = 0; i < n_states; ++i) {
+      sum += PopCount(i);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  SetStateCounters(state, n_states, 0);
+}
+
+// lookup every state of a coloring that is only known at runtime
+template <class ColorAssignment, typename NumberType>
+static void LookupAll(benchmark::State& state,
+                      const ColorAssignment& coloring, NumberType ndim) {
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  for (auto _ : state) {
+    NumberType sum = 0;
+    for (NumberType i = 0; i < n_states; ++i) {
+      sum += coloring[i];
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+}
+
+template <typename NumberType>
+static void BM_MirrorAssignment(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  benchmark::DoNotOptimize(ndim);
+  MirrorAssignment<NumberType> coloring(ndim);
+  LookupAll(state, coloring, ndim);
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim), 0);
+}
+
+template <typename NumberType>
+static void BM_MirrorTableAssignment(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  benchmark::DoNotOptimize(ndim);
+  MirrorTableAssignment<NumberType> coloring(ndim);
+  LookupAll(state, coloring, ndim);
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim), 0);
+}
+
+template <typename NumberType>
+static void BM_GreedyColorOracle(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  benchmark::DoNotOptimize(ndim);
+  GreedyColorOracle<NumberType> coloring(ndim);
+  LookupAll(state, coloring, ndim);
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim), 0);
+}
+
+// Check the closed neighborhood of every state the way ValidateColoring does,
+// without stopping at the first failure so that the whole cube is measured
+template <class ColorAssignment, typename NumberType>
+static void ValidateAll(benchmark::State& state,
+                        const ColorAssignment& coloring, NumberType ndim) {
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  for (auto _ : state) {
+    NumberType n_failed = 0;
+    for (NumberType i = 0; i < n_states; ++i) {
+      n_failed += PopCount(GetColorsSeen(coloring, ndim, i)) != ndim;
+    }
+    benchmark::DoNotOptimize(n_failed);
+  }
+}
+
+template <typename NumberType>
+static void BM_ValidateMirror(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  benchmark::DoNotOptimize(ndim);
+  MirrorTableAssignment<NumberType> coloring(ndim);
+  ValidateAll(state, coloring, ndim);
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim), 0);
+}
+
+template <typename NumberType>
+static void BM_ValidateVector(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  std::vector<NumberType> coloring = GenerateColoring<NumberType>(ndim);
+  ValidateAll(state, coloring, ndim);
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   sizeof(NumberType));
+}
+
+template <typename NumberType>
+static void BM_ValidatePacked(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  PackedColoring<NumberType> coloring;
+  GenerateColoring(ndim, &coloring);
+  ValidateAll(state, coloring, ndim);
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   coloring.bits_per_color_ / 8.0);
+}
+
+template <typename NumberType>
+static void BM_ValidateBlocked(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  std::vector<NumberType> coloring = GenerateColoring<NumberType>(ndim);
+  for (auto _ : state) {
+    NumberType n_failed = 0;
+    ForEachViolationBlocked(coloring, ndim, NumberType(kDefaultBlockDimensions),
+                            [&](NumberType, NumberType) {
+                              ++n_failed;
+                              return true;
+                            });
+    benchmark::DoNotOptimize(n_failed);
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   sizeof(NumberType));
+}
+
+template <typename NumberType>
+static void BM_ValidateGray(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  std::vector<NumberType> coloring = GenerateColoring<NumberType>(ndim);
+  for (auto _ : state) {
+    NumberType n_failed = 0;
+    ForEachViolationGray(coloring, ndim, [&](NumberType) {
+      ++n_failed;
+      return true;
+    });
+    benchmark::DoNotOptimize(n_failed);
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   sizeof(NumberType));
+}
+
+template <typename NumberType>
+static void BM_ValidateBitPlanes(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  BitPlaneColoring<NumberType> coloring(GenerateColoring<NumberType>(ndim),
+                                        ndim);
+  uint64_t word_mask = coloring.GetWordMask();
+  for (auto _ : state) {
+    NumberType n_failed = 0;
+    for (uint64_t word = 0; word < coloring.n_words_; ++word) {
+      n_failed += PopCount(~coloring.GetCoveredStates(word) & word_mask);
+    }
+    benchmark::DoNotOptimize(n_failed);
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   coloring.n_colors_ / 8.0);
+}
+
+// validate range(1) candidates together with SimdBackend range(2), items are
+// candidate-states. The candidates are distinct relabelings of the colors of
+// GenerateColoring.
+template <typename NumberType>
+static void BM_ValidateBatch(benchmark::State& state) {
+  SimdBackend backend = static_cast<SimdBackend>(state.range(2));
+  if (backend != SimdBackend::kScalar &&
+      GetBestSimdBackend() == SimdBackend::kScalar) {
+    state.SkipWithError("avx2 unsupported");
+    return;
+  }
+  NumberType ndim = state.range(0);
+  std::vector<NumberType> coloring = GenerateColoring<NumberType>(ndim);
+  std::vector<std::vector<NumberType>> candidates;
+  std::mt19937 rng(0);
+  for (int64_t k = 0; k < state.range(1); ++k) {
+    std::vector<NumberType> relabel(GetNumberOfColors<NumberType>(ndim));
+    std::iota(relabel.begin(), relabel.end(), 0);
+    std::shuffle(relabel.begin(), relabel.end(), rng);
+    candidates.emplace_back(coloring.size());
+    for (size_t j = 0; j < coloring.size(); ++j) {
+      candidates.back()[j] = relabel[coloring[j]];
+    }
+  }
+  ColoringBatch<NumberType> batch(candidates, ndim);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ValidateColoringBatch(batch, backend));
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim) * state.range(1),
+                   sizeof(uint8_t));
+}
+
+template <typename NumberType>
+static void BM_GenerateColoring(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  for (auto _ : state) {
+    std::vector<NumberType> coloring = GenerateColoring<NumberType>(ndim);
+    benchmark::DoNotOptimize(coloring.data());
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   sizeof(NumberType));
+}
+
+// generate with range(1) threads
+template <typename NumberType>
+static void BM_ParallelGenerateColoring(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  for (auto _ : state) {
+    std::vector<NumberType> coloring =
+        ParallelGenerateColoring<NumberType>(ndim, state.range(1));
+    benchmark::DoNotOptimize(coloring.data());
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   sizeof(NumberType));
+}
+
+template <typename NumberType>
+static void BM_GenerateColoringPacked(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  PackedColoring<NumberType> coloring;
+  for (auto _ : state) {
+    GenerateColoring(ndim, &coloring);
+    benchmark::DoNotOptimize(coloring.words_.data());
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   GetBitsPerColor(GetNumberOfColors<NumberType>(ndim)) / 8.0);
+}
+
+// stream every pair of the cube, failing if the stream does not end with
+// exactly the states and colors of GenerateColoring
+template <typename NumberType>
+static void BM_TopologicalColoringStream(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  std::vector<NumberType> expected = GenerateColoring<NumberType>(ndim);
+  for (auto _ : state) {
+    TopologicalColoringStream<NumberType> stream(ndim);
+    NumberType n_pairs = 0;
+    NumberType current_state;
+    NumberType color;
+    bool is_ok = true;
+    while (stream.Next(&current_state, &color)) {
+      is_ok &= expected[current_state] == color;
+      ++n_pairs;
+    }
+    if (!is_ok || n_pairs != expected.size() ||
+        stream.Next(&current_state, &color)) {
+      state.SkipWithError("stream does not match GenerateColoring");
+      break;
+    }
+  }
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim),
+                   sizeof(NumberType));
+}
+
+// discards the pairs, so that only the pipeline itself is measured
+struct NullSink {
+  template <typename NumberType>
+  void Add(NumberType state, NumberType color) {
+    benchmark::DoNotOptimize(state);
+    benchmark::DoNotOptimize(color);
+  }
+};
+
+template <typename NumberType>
+static void BM_PipelineColoring(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  NullSink sink;
+  // the greedy coloring is invalid, drop the violation report
+  std::streambuf* cout_buffer = std::cout.rdbuf(nullptr);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(PipelineColoring(ndim, sink));
+  }
+  std::cout.rdbuf(cout_buffer);
+  std::cout.clear();
+  SetStateCounters(state, GetNumberOfStates<NumberType>(ndim), 0);
+}
+
+// recolor states one at a time, cycling through the colors
+template <typename NumberType>
+static void BM_IncrementalRecolor(benchmark::State& state) {
+  NumberType ndim = state.range(0);
+  NumberType n_states = GetNumberOfStates<NumberType>(ndim);
+  IncrementalValidator<NumberType> validator(
+      GenerateColoring<NumberType>(ndim), ndim);
+  NumberType current_state = 0;
+  for (auto _ : state) {
+    validator.Recolor(current_state, (validator[current_state] + 1) % ndim);
+    current_state = (current_state + 1) % n_states;
+    benchmark::DoNotOptimize(validator.GetNumberOfViolations());
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes_per_state"] = ndim + 2;
+}
+
+#define DEVILS_CHECKERBOARD_BENCHMARK(name)                               \
+  BENCHMARK_TEMPLATE(name, uint32_t)->DenseRange(8, 20, 4);               \
+  BENCHMARK_TEMPLATE(name, uint64_t)->DenseRange(8, 20, 4)
+
+BENCHMARK_TEMPLATE(BM_ValidateBatch, uint32_t)
+    ->ArgsProduct({{12, 16, 20}, {1, 8, 16}, {0, 1}});
+BENCHMARK_TEMPLATE(BM_ValidateBatch, uint64_t)
+    ->ArgsProduct({{12, 16, 20}, {1, 8, 16}, {0, 1}});
+
+BENCHMARK_TEMPLATE(BM_ParallelGenerateColoring, uint64_t)
+    ->ArgsProduct({{16, 20, 24}, {1, 2, 4}})
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_PipelineColoring, uint64_t)
+    ->DenseRange(12, 20, 4)
+    ->UseRealTime();
+
+// large cubes, where the coloring no longer fits in cache
+BENCHMARK_TEMPLATE(BM_ValidateVector, uint64_t)->Arg(24);
+BENCHMARK_TEMPLATE(BM_ValidateBlocked, uint64_t)->Arg(24);
+
+DEVILS_CHECKERBOARD_BENCHMARK(BM_PopCount);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_MirrorAssignment);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_MirrorTableAssignment);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_GreedyColorOracle);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_ValidateMirror);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_ValidateVector);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_ValidatePacked);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_ValidateBlocked);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_ValidateGray);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_ValidateBitPlanes);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_GenerateColoring);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_GenerateColoringPacked);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_TopologicalColoringStream);
+DEVILS_CHECKERBOARD_BENCHMARK(BM_IncrementalRecolor);
+
+BENCHMARK_MAIN();
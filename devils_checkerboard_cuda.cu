@@ -0,0 +1,135 @@
+#include <cstdint>
+#include <cstdio>
+
+#include "devils_checkerboard_cuda.h"
+
+// Report a failed cuda call and return false from the enclosing function
+#define CUDA_CHECK(call)                                              \
+  do {                                                                \
+    cudaError_t error = (call);                                       \
+    if (error != cudaSuccess) {                                       \
+      fprintf(stderr, "%s failed: %s\n", #call,                       \
+              cudaGetErrorString(error));                             \
+      return false;                                                   \
+    }                                                                 \
+  } while (0)
+
+// Device allocation that is freed when it goes out of scope, so that the
+// early returns of CUDA_CHECK do not leak it
+struct DeviceBuffer {
+  DeviceBuffer() : data_(nullptr) {}
+
+  ~DeviceBuffer() {
+    if (data_) {
+      cudaFree(data_);
+    }
+  }
+
+  DeviceBuffer(const DeviceBuffer&) = delete;
+  DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+
+  unsigned long long* data_;
+};
+
+// same unpacking as PackedColorView::operator[]
+__device__ inline unsigned GetPackedColor(const unsigned long long* words,
+                                          unsigned bits_per_color,
+                                          unsigned long long state) {
+  unsigned long long bit = state * bits_per_color;
+  unsigned long long word = bit / 64;
+  unsigned offset = bit % 64;
+  unsigned long long value = words[word] >> offset;
+  if (offset + bits_per_color > 64) {
+    value |= words[word + 1] << (64 - offset);
+  }
+  return value & ((1ull << bits_per_color) - 1);
+}
+
+// Each thread checks the closed neighborhood of its states in a grid-stride
+// loop. Counts and first failures are reduced within the block in shared
+// memory, then merged into the global results with one atomic per block.
+__global__ void ValidatePackedKernel(const unsigned long long* words,
+                                     unsigned bits_per_color, unsigned ndim,
+                                     unsigned n_colors,
+                                     unsigned long long n_states,
+                                     unsigned long long* n_violations,
+                                     unsigned long long* first_failure) {
+  __shared__ unsigned long long block_violations;
+  __shared__ unsigned long long block_first_failure;
+  if (threadIdx.x == 0) {
+    block_violations = 0;
+    block_first_failure = n_states;
+  }
+  __syncthreads();
+
+  unsigned long long local_violations = 0;
+  unsigned long long local_first_failure = n_states;
+  unsigned long long stride =
+      static_cast<unsigned long long>(gridDim.x) * blockDim.x;
+  for (unsigned long long state =
+           static_cast<unsigned long long>(blockIdx.x) * blockDim.x +
+           threadIdx.x;
+       state < n_states; state += stride) {
+    unsigned long long colors_seen =
+        1ull << GetPackedColor(words, bits_per_color, state);
+    for (unsigned i = 0; i < ndim; ++i) {
+      colors_seen |=
+          1ull << GetPackedColor(words, bits_per_color, state ^ (1ull << i));
+    }
+    if (__popcll(colors_seen) != n_colors) {
+      ++local_violations;
+      if (state < local_first_failure) {
+        local_first_failure = state;
+      }
+    }
+  }
+
+  if (local_violations) {
+    atomicAdd(&block_violations, local_violations);
+    atomicMin(&block_first_failure, local_first_failure);
+  }
+  __syncthreads();
+
+  if (threadIdx.x == 0 && block_violations) {
+    atomicAdd(n_violations, block_violations);
+    atomicMin(first_failure, block_first_failure);
+  }
+}
+
+bool CudaValidatePackedColoring(const uint64_t* words, uint64_t n_words,
+                                unsigned bits_per_color, unsigned ndim,
+                                uint64_t* n_violations,
+                                uint64_t* first_failure) {
+  static const unsigned kBlockSize = 256;
+  unsigned long long n_states = 1ull << ndim;
+  unsigned long long results[2] = {0, n_states};
+
+  DeviceBuffer device_words;
+  DeviceBuffer device_results;
+  CUDA_CHECK(cudaMalloc(&device_words.data_, n_words * sizeof(uint64_t)));
+  CUDA_CHECK(cudaMalloc(&device_results.data_, sizeof(results)));
+  CUDA_CHECK(cudaMemcpy(device_words.data_, words, n_words * sizeof(uint64_t),
+                        cudaMemcpyHostToDevice));
+  CUDA_CHECK(cudaMemcpy(device_results.data_, results, sizeof(results),
+                        cudaMemcpyHostToDevice));
+
+  int n_multiprocessors = 0;
+  CUDA_CHECK(cudaDeviceGetAttribute(&n_multiprocessors,
+                                    cudaDevAttrMultiProcessorCount, 0));
+  unsigned long long n_blocks = (n_states + kBlockSize - 1) / kBlockSize;
+  unsigned long long max_blocks = 32ull * n_multiprocessors;
+  if (n_blocks > max_blocks) {
+    n_blocks = max_blocks;
+  }
+
+  ValidatePackedKernel<<<static_cast<unsigned>(n_blocks), kBlockSize>>>(
+      device_words.data_, bits_per_color, ndim, ndim, n_states,
+      &device_results.data_[0], &device_results.data_[1]);
+  CUDA_CHECK(cudaGetLastError());
+  CUDA_CHECK(cudaMemcpy(results, device_results.data_, sizeof(results),
+                        cudaMemcpyDeviceToHost));
+
+  *n_violations = results[0];
+  *first_failure = results[1];
+  return true;
+}
@@ -0,0 +1,15 @@
+#ifndef DEVILS_CHECKERBOARD_CUDA_H_
+#define DEVILS_CHECKERBOARD_CUDA_H_
+
+#include <cstdint>
+
+// Validate a coloring packed as in PackedColoring on the gpu, one thread per
+// state. Returns the number of violating states and the lowest one (or
+// 2^ndim if there is none). Returns false if a cuda call failed, after
+// printing its error.
+bool CudaValidatePackedColoring(const uint64_t* words, uint64_t n_words,
+                                unsigned bits_per_color, unsigned ndim,
+                                uint64_t* n_violations,
+                                uint64_t* first_failure);
+
+#endif  // DEVILS_CHECKERBOARD_CUDA_H_
@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#include "devils_checkerboard.h"
+#include "devils_checkerboard_cuda.h"
+
+// Validate a coloring on the gpu. Usage:
+//   devils_checkerboard_cuda <ndim>             greedy coloring of dimension
+//   devils_checkerboard_cuda <coloring file>    coloring file from
+//                                               WriteColoringFile
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fmt::print(std::cerr, "usage: {} <ndim | coloring file>\n", argv[0]);
+    return 1;
+  }
+
+  std::string arg = argv[1];
+  PackedColoring<uint64_t> generated;
+  MappedColoring<uint64_t> mapped;
+  uint64_t ndim = 0;
+  const uint64_t* words = nullptr;
+  uint64_t n_words = 0;
+  unsigned bits_per_color = 0;
+  if (arg.find_first_not_of("0123456789") == std::string::npos) {
+    ndim = std::strtoull(arg.c_str(), nullptr, 10);
+    if (ndim < 1 || ndim > 63) {
+      fmt::print(std::cerr, "Unsupported dimension {}\n", arg);
+      fmt::print(std::cerr, "usage: {} <ndim | coloring file>\n", argv[0]);
+      return 1;
+    }
+    GenerateColoring(ndim, &generated);
+    words = generated.words_.data();
+    n_words = generated.words_.size();
+    bits_per_color = generated.bits_per_color_;
+  } else {
+    if (!mapped.Open(arg)) {
+      return 1;
+    }
+    ndim = mapped.ndim_;
+    words = mapped.view_.words_;
+    n_words = mapped.GetHeader()->num_words;
+    bits_per_color = mapped.view_.bits_per_color_;
+  }
+
+  fmt::print(std::cout, "n = {}, {} states, {} colors\n", ndim,
+             GetNumberOfStates<uint64_t>(ndim),
+             GetNumberOfColors<uint64_t>(ndim));
+
+  uint64_t n_violations = 0;
+  uint64_t first_failure = 0;
+  if (!CudaValidatePackedColoring(words, n_words, bits_per_color,
+                                  static_cast<unsigned>(ndim), &n_violations,
+                                  &first_failure)) {
+    return 1;
+  }
+
+  if (n_violations) {
+    PackedColorView<uint64_t> view(words, bits_per_color);
+    ReportViolation(ndim, first_failure,
+                    GetColorsSeen(view, ndim, first_failure));
+  }
+  fmt::print(std::cout, "Violations: {}\n", n_violations);
+  fmt::print(std::cout, "Validated: {}\n", (n_violations ? "no" : "yes"));
+  return 0;
+}
@@ -0,0 +1,228 @@
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#include "devils_checkerboard.h"
+
+// Validate a coloring with the state space sharded over MPI ranks. Usage:
+//   devils_checkerboard_mpi mirror <ndim>     mirror coloring, computed
+//   devils_checkerboard_mpi oracle <ndim>     greedy coloring, computed
+//   devils_checkerboard_mpi greedy <ndim>     greedy coloring, materialized
+//   devils_checkerboard_mpi file:PATH         coloring file from
+//                                             WriteColoringFile, materialized
+//
+// Every rank owns the states whose top shard_bits bits fall in its range of
+// blocks. Computed colorings look up the neighbors of other shards locally.
+// A materialized rank only holds the colors of its own block, and receives
+// the block across each of the top bits from the rank that owns it. This
+// needs the number of ranks to be a power of two, so that every rank owns
+// exactly one block.
+
+// the states [begin, end) owned by a rank
+struct Shard {
+  unsigned shard_bits;
+  uint64_t begin;
+  uint64_t end;
+};
+
+static Shard GetShard(uint64_t ndim, int rank, int n_ranks) {
+  Shard shard;
+  shard.shard_bits = 0;
+  while ((UINT64_C(1) << shard.shard_bits) < static_cast<uint64_t>(n_ranks) &&
+         shard.shard_bits < ndim) {
+    ++shard.shard_bits;
+  }
+  uint64_t n_blocks = UINT64_C(1) << shard.shard_bits;
+  uint64_t block_size = GetNumberOfStates<uint64_t>(ndim) >> shard.shard_bits;
+  shard.begin = rank * n_blocks / n_ranks * block_size;
+  shard.end = (rank + 1) * n_blocks / n_ranks * block_size;
+  return shard;
+}
+
+template <class ColorAssignment>
+static void ValidateComputedShard(const ColorAssignment& coloring,
+                                  uint64_t ndim, const Shard& shard,
+                                  uint64_t* n_violations,
+                                  uint64_t* first_failure,
+                                  uint64_t* first_colors_seen) {
+  uint64_t n_colors = GetNumberOfColors<uint64_t>(ndim);
+  for (uint64_t state = shard.begin; state < shard.end; ++state) {
+    uint64_t colors_seen = GetColorsSeen(coloring, ndim, state);
+    if (PopCount(colors_seen) != n_colors) {
+      if (*n_violations == 0) {
+        *first_failure = state;
+        *first_colors_seen = colors_seen;
+      }
+      ++*n_violations;
+    }
+  }
+}
+
+// exchange equally sized buffers with partner, in messages that fit an int
+static void ExchangeBlock(const std::vector<uint8_t>& send,
+                          std::vector<uint8_t>* receive, int partner) {
+  static const size_t kMaxMessageSize = size_t(1) << 30;
+  for (size_t offset = 0; offset < send.size(); offset += kMaxMessageSize) {
+    int size =
+        static_cast<int>(std::min(kMaxMessageSize, send.size() - offset));
+    MPI_Sendrecv(send.data() + offset, size, MPI_UINT8_T, partner, 0,
+                 receive->data() + offset, size, MPI_UINT8_T, partner, 0,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  }
+}
+
+// The neighbor of local state k across top bit j is state k of the block
+// of rank ^ 2^j, so each halo is a whole block that is consumed and then
+// overwritten by the next one.
+static void ValidateMaterializedShard(const std::vector<uint8_t>& colors,
+                                      uint64_t ndim, const Shard& shard,
+                                      int rank, uint64_t* n_violations,
+                                      uint64_t* first_failure,
+                                      uint64_t* first_colors_seen) {
+  uint64_t n_colors = GetNumberOfColors<uint64_t>(ndim);
+  uint64_t local_bits = ndim - shard.shard_bits;
+  uint64_t block_size = colors.size();
+
+  std::vector<uint64_t> colors_seen(block_size);
+  for (uint64_t k = 0; k < block_size; ++k) {
+    uint64_t mask = UINT64_C(0x01) << colors[k];
+    for (uint64_t i = 0; i < local_bits; ++i) {
+      mask |= UINT64_C(0x01) << colors[k ^ (UINT64_C(0x01) << i)];
+    }
+    colors_seen[k] = mask;
+  }
+
+  std::vector<uint8_t> halo(block_size);
+  for (unsigned j = 0; j < shard.shard_bits; ++j) {
+    ExchangeBlock(colors, &halo, rank ^ (1 << j));
+    for (uint64_t k = 0; k < block_size; ++k) {
+      colors_seen[k] |= UINT64_C(0x01) << halo[k];
+    }
+  }
+
+  for (uint64_t k = 0; k < block_size; ++k) {
+    if (PopCount(colors_seen[k]) != n_colors) {
+      if (*n_violations == 0) {
+        *first_failure = shard.begin + k;
+        *first_colors_seen = colors_seen[k];
+      }
+      ++*n_violations;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  MPI_Init(&argc, &argv);
+  int rank = 0;
+  int n_ranks = 1;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_ranks);
+
+  // sources are spelled as in --source of devils_checkerboard
+  std::string source = argc > 1 ? argv[1] : "";
+  bool is_computed = source == "mirror" || source == "oracle";
+  bool is_file = source.compare(0, 5, "file:") == 0 && source.size() > 5;
+  bool is_ok = is_file ? argc == 2
+                       : argc == 3 && (is_computed || source == "greedy");
+  if (!is_ok) {
+    if (rank == 0) {
+      fmt::print(std::cerr,
+                 "usage: {} <mirror | oracle | greedy> <ndim>\n"
+                 "       {} file:PATH\n",
+                 argv[0], argv[0]);
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  MappedColoring<uint64_t> mapped;
+  uint64_t ndim = 0;
+  if (is_file) {
+    if (!mapped.Open(source.substr(5))) {
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    ndim = mapped.ndim_;
+  } else {
+    ndim = std::strtoull(argv[2], nullptr, 10);
+  }
+  if (ndim < 1 || ndim > 63 || (!is_computed && ndim > 62)) {
+    if (rank == 0) {
+      fmt::print(std::cerr, "Unsupported dimension {}\n", ndim);
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  Shard shard = GetShard(ndim, rank, n_ranks);
+  if (!is_computed && n_ranks != (1 << shard.shard_bits)) {
+    if (rank == 0) {
+      fmt::print(std::cerr,
+                 "Materialized colorings need a power of two of at most {} "
+                 "ranks\n",
+                 GetNumberOfStates<uint64_t>(ndim));
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  double start = MPI_Wtime();
+  uint64_t n_states = GetNumberOfStates<uint64_t>(ndim);
+  uint64_t n_violations = 0;
+  uint64_t first_failure = n_states;
+  uint64_t first_colors_seen = 0;
+  if (source == "mirror") {
+    ValidateComputedShard(MirrorTableAssignment<uint64_t>(ndim), ndim, shard,
+                          &n_violations, &first_failure, &first_colors_seen);
+  } else if (source == "oracle") {
+    ValidateComputedShard(GreedyColorOracle<uint64_t>(ndim), ndim, shard,
+                          &n_violations, &first_failure, &first_colors_seen);
+  } else {
+    // the colors of this rank's block, one byte each
+    std::vector<uint8_t> colors(shard.end - shard.begin);
+    GreedyColorOracle<uint64_t> greedy(ndim);
+    for (uint64_t k = 0; k < colors.size(); ++k) {
+      uint64_t state = shard.begin + k;
+      colors[k] = static_cast<uint8_t>(is_file ? mapped[state] : greedy[state]);
+    }
+    ValidateMaterializedShard(colors, ndim, shard, rank, &n_violations,
+                              &first_failure, &first_colors_seen);
+  }
+
+  uint64_t total_violations = 0;
+  uint64_t global_first_failure = n_states;
+  MPI_Allreduce(&n_violations, &total_violations, 1, MPI_UINT64_T, MPI_SUM,
+                MPI_COMM_WORLD);
+  MPI_Allreduce(&first_failure, &global_first_failure, 1, MPI_UINT64_T,
+                MPI_MIN, MPI_COMM_WORLD);
+  // only the owner of the first failure contributes its colors
+  uint64_t owned_colors_seen =
+      first_failure == global_first_failure ? first_colors_seen : 0;
+  uint64_t global_colors_seen = 0;
+  MPI_Reduce(&owned_colors_seen, &global_colors_seen, 1, MPI_UINT64_T,
+             MPI_BOR, 0, MPI_COMM_WORLD);
+  double seconds = MPI_Wtime() - start;
+
+  if (rank == 0) {
+    fmt::print(std::cout, "n = {}, {} states, {} colors\n", ndim, n_states,
+               GetNumberOfColors<uint64_t>(ndim));
+    fmt::print(std::cout, "Ranks: {}, shard bits: {}\n", n_ranks,
+               shard.shard_bits);
+    if (total_violations) {
+      ReportViolation(ndim, global_first_failure, global_colors_seen);
+    }
+    fmt::print(std::cout, "Violations: {}\n", total_violations);
+    fmt::print(std::cout, "Validated: {}\n", (total_violations ? "no" : "yes"));
+    fmt::print(std::cout, "Validate: {:.6f} s\n", seconds);
+  }
+
+  MPI_Finalize();
+  return 0;
+}